@@ -1,8 +1,9 @@
 #include <iostream>
 #include <thread>
 #include <vector>
-#include <chrono>
-#include <iomanip>
+#include <string>
+
+#include "bench.h"
 
 using namespace std;
 
@@ -37,30 +38,30 @@ void transpose_multi(int** a, int n, int threads_num) {
         current = end_i;
         if (start_i >= end_i)
             break;
-        threads.emplace_back(transpose_part, a, n, start_i, end_i);
+        threads.emplace_back([=] {
+            bench::pinCurrentThread(t);
+            transpose_part(a, n, start_i, end_i);
+        });
     }
     for (auto& th : threads) {
         th.join();
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
-    int matrix_sizes[] = {500, 1000, 2000, 5000, 10000, 20000};
-    int matrix_sizes_count = sizeof(matrix_sizes) / sizeof(matrix_sizes[0]);
-
-    int thread_counts[] = {1, 2, 4, 8, 16, 32, 64, 128, 256};
-    int thread_counts_count = sizeof(thread_counts) / sizeof(thread_counts[0]);
-
-    cout << fixed << setprecision(5);
-    cout << "-----------------------------------------------------------\n";
-    cout << " MatrixSize | Threads |   Time (s) |   Check\n";
-    cout << "-----------------------------------------------------------\n";
+    bench::Config cfg;
+    cfg.sizes = {500, 1000, 2000, 5000, 10000, 20000};
+    cfg.threads = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+    if (!bench::parseArgs(argc, argv, cfg))
+        return 1;
+    bench::Runner runner(cfg);
+    bool all_ok = true;
 
-    for (int idx = 0; idx < matrix_sizes_count; idx++) {
-        int n = matrix_sizes[idx];
+    for (long long size : cfg.sizes) {
+        int n = (int)size;
 
         int** a = new int*[n];
         int** orig = new int*[n];
@@ -77,31 +78,25 @@ int main() {
             }
         }
 
-        for (int t = 0; t < thread_counts_count; t++) {
-            int threads_num = thread_counts[t];
-
-            for (int i = 0; i < n; i++) {
-                for (int j = 0; j < n; j++) {
-                    a[i][j] = orig[i][j];
+        // Every element is read and written once per transpose.
+        double bytes = 2.0 * n * n * sizeof(int);
+        for (long long threads_num : cfg.threads) {
+            auto restore = [&] {
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        a[i][j] = orig[i][j];
+                    }
                 }
-            }
+            };
+            runner.run("transpose", {{"size", to_string(n)}, {"threads", to_string(threads_num)}}, bytes, restore,
+                       [&] { transpose_multi(a, n, (int)threads_num); });
 
-            auto start = chrono::high_resolution_clock::now();
-            transpose_multi(a, n, threads_num);
-            auto end = chrono::high_resolution_clock::now();
-
-            chrono::duration<double> dur = end - start;
-
-            bool ok = is_transposed_ok(orig, a, n);
-
-            cout << setw(11) << n << " | "
-                 << setw(7) << threads_num << " | "
-                 << setw(10) << dur.count() << " | "
-                 << (ok ? "   OK" : " ERROR") << "\n";
+            if (!is_transposed_ok(orig, a, n)) {
+                cerr << "transpose " << n << " x " << threads_num << " threads: wrong result\n";
+                all_ok = false;
+            }
         }
 
-        cout << "-----------------------------------------------------------\n";
-
         for (int i = 0; i < n; i++) {
             delete[] a[i];
             delete[] orig[i];
@@ -110,5 +105,5 @@ int main() {
         delete[] orig;
     }
 
-    return 0;
+    return runner.finish() && all_ok ? 0 : 1;
 }
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Shared benchmark harness for the lab sweeps. Every case runs a few
+// untimed warmup passes and then a number of timed repetitions, each after
+// an untimed setup step, and is reported as median, min, mean and stddev.
+// On Linux, cycles, instructions, last-level cache misses and dTLB misses are
+// counted around every repetition with perf_event_open; the counters inherit
+// into the threads a kernel starts, so they cover the whole parallel run.
+// Where the kernel refuses (perf_event_paranoid, containers, other systems)
+// the columns are left empty and the timings stand on their own.
+//
+// Results are printed as a table as they complete and can be written as CSV
+// and JSON. Bandwidth (from the bytes a case declares) together with IPC and
+// misses per repetition tells a memory-bound sweep, whose GB/s flattens while
+// misses stay put, from a sync-bound one, whose cycles grow without the
+// instructions or misses to show for it.
+namespace bench {
+
+struct Config {
+    int warmup = 1;
+    int repetitions = 5;
+    bool pin = true;
+    bool counters = true;
+    std::vector<long long> sizes;    // the lab's defaults unless --sizes is given
+    std::vector<long long> threads;  // likewise for --threads
+    std::string csvPath;
+    std::string jsonPath;
+};
+
+// Whole-string integer parse; throws std::invalid_argument or
+// std::out_of_range on anything else, trailing junk included.
+inline long long parseNumber(const std::string& s) {
+    size_t used = 0;
+    long long v = std::stoll(s, &used);
+    if (used != s.size()) throw std::invalid_argument(s);
+    return v;
+}
+
+inline std::vector<long long> parseList(const std::string& s) {
+    std::vector<long long> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty()) out.push_back(parseNumber(item));
+    return out;
+}
+
+inline bool parseArgs(int argc, char** argv, Config& cfg) {
+    auto usage = [&] {
+        std::cerr << "usage: " << argv[0] << " [--warmup N] [--reps N] [--no-pin] [--no-counters]\n"
+                  << "       [--sizes a,b,...] [--threads 1,2,...] [--csv file] [--json file]\n";
+        return false;
+    };
+    auto toInt = [](const std::string& s) {
+        long long v = parseNumber(s);
+        if (v < INT_MIN || v > INT_MAX) throw std::out_of_range(s);
+        return (int)v;
+    };
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+            if (arg == "--warmup") cfg.warmup = toInt(value());
+            else if (arg == "--reps") cfg.repetitions = toInt(value());
+            else if (arg == "--no-pin") cfg.pin = false;
+            else if (arg == "--no-counters") cfg.counters = false;
+            else if (arg == "--sizes") cfg.sizes = parseList(value());
+            else if (arg == "--threads") cfg.threads = parseList(value());
+            else if (arg == "--csv") cfg.csvPath = value();
+            else if (arg == "--json") cfg.jsonPath = value();
+            else return usage();
+        }
+    } catch (const std::logic_error&) {  // invalid_argument, out_of_range
+        return usage();
+    }
+    if (cfg.warmup < 0 || cfg.repetitions <= 0) return usage();
+    return true;
+}
+
+inline bool g_pin = false;
+
+// Kernels call this first thing in every worker they start; worker `index`
+// is bound to core index % cores, so reruns land on the same cores.
+inline void pinCurrentThread(int index) {
+#ifdef __linux__
+    if (!g_pin) return;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+enum Counter { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, COUNTER_COUNT };
+
+inline const char* counterName(int c) {
+    static const char* names[] = {"cycles", "instructions", "llc_misses", "dtlb_misses"};
+    return names[c];
+}
+
+using CounterValues = std::array<double, COUNTER_COUNT>;  // NaN where unavailable
+
+// One inheriting counter per event on the calling thread. They are never
+// reset, since reset does not clear what exited children folded back in;
+// a repetition is measured as the difference of two snapshots, scaled by
+// enabled/running time in case the PMU had to multiplex.
+class Counters {
+public:
+    Counters() { m_fds.fill(-1); }
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+
+    ~Counters() {
+#ifdef __linux__
+        for (int fd : m_fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool open() {
+        bool any = false;
+#ifdef __linux__
+        auto cache = [](uint64_t id) {
+            return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        const std::pair<uint32_t, uint64_t> events[COUNTER_COUNT] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL)},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB)},
+        };
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[c].first;
+            attr.config = events[c].second;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            m_fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            any |= m_fds[c] >= 0;
+        }
+#endif
+        return any;
+    }
+
+    struct Snapshot {
+        std::array<uint64_t, COUNTER_COUNT * 3> raw{};  // value, enabled, running
+    };
+
+    Snapshot snapshot() const {
+        Snapshot s;
+#ifdef __linux__
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            if (m_fds[c] >= 0 && read(m_fds[c], &s.raw[c * 3], 3 * sizeof(uint64_t)) != 3 * sizeof(uint64_t))
+                s.raw[c * 3 + 2] = 0;
+#endif
+        return s;
+    }
+
+    CounterValues delta(const Snapshot& a, const Snapshot& b) const {
+        CounterValues v;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            double value = (double)(b.raw[c * 3] - a.raw[c * 3]);
+            double enabled = (double)(b.raw[c * 3 + 1] - a.raw[c * 3 + 1]);
+            double running = (double)(b.raw[c * 3 + 2] - a.raw[c * 3 + 2]);
+            v[c] = m_fds[c] < 0 || running <= 0 ? NAN : value * enabled / running;
+        }
+        return v;
+    }
+
+private:
+    std::array<int, COUNTER_COUNT> m_fds;
+};
+
+using Params = std::vector<std::pair<std::string, std::string>>;
+
+struct Result {
+    std::string kernel;
+    Params params;
+    std::vector<double> seconds;
+    double median = 0, min = 0, mean = 0, stddev = 0;
+    double bytes = 0;        // memory traffic of one run as declared by the caller
+    CounterValues counters;  // mean per repetition
+
+    double gbPerSec() const { return bytes > 0 && median > 0 ? bytes / median / 1e9 : NAN; }
+    double ipc() const { return counters[INSTRUCTIONS] / counters[CYCLES]; }
+};
+
+class Runner {
+public:
+    explicit Runner(const Config& cfg) : m_cfg(cfg) {
+        g_pin = cfg.pin;
+        m_haveCounters = cfg.counters && m_counters.open();
+        if (cfg.counters && !m_haveCounters)
+            std::cerr << "[bench] hardware counters unavailable; reporting timings only\n";
+        std::cout << std::left << std::setw(12) << "Kernel" << std::setw(36) << "Params" << std::setw(12)
+                  << "Median(s)" << std::setw(12) << "Min(s)" << std::setw(9) << "+-%" << std::setw(9) << "GB/s"
+                  << std::setw(7) << "IPC" << std::setw(12) << "LLC miss" << "dTLB miss\n"
+                  << std::string(121, '-') << "\n";
+    }
+
+    // `setup` runs untimed before every pass, e.g. to restore the input an
+    // in-place kernel overwrote; only `body` is timed and counted.
+    template <class Setup, class Body>
+    const Result& run(const std::string& kernel, Params params, double bytes, Setup&& setup, Body&& body) {
+        for (int i = 0; i < m_cfg.warmup; i++) {
+            setup();
+            body();
+        }
+        Result r;
+        r.kernel = kernel;
+        r.params = std::move(params);
+        r.bytes = bytes;
+        r.counters.fill(0);
+        for (int i = 0; i < m_cfg.repetitions; i++) {
+            setup();
+            auto before = m_counters.snapshot();
+            auto t0 = std::chrono::steady_clock::now();
+            body();
+            auto t1 = std::chrono::steady_clock::now();
+            auto after = m_counters.snapshot();
+            r.seconds.push_back(std::chrono::duration<double>(t1 - t0).count());
+            CounterValues v = m_haveCounters ? m_counters.delta(before, after) : CounterValues{};
+            for (int c = 0; c < COUNTER_COUNT; c++)
+                r.counters[c] += m_haveCounters ? v[c] / m_cfg.repetitions : NAN;
+        }
+        summarize(r);
+        print(r);
+        m_results.push_back(std::move(r));
+        return m_results.back();
+    }
+
+    template <class Body>
+    const Result& run(const std::string& kernel, Params params, double bytes, Body&& body) {
+        return run(kernel, std::move(params), bytes, [] {}, std::forward<Body>(body));
+    }
+
+    // Writes the requested CSV and JSON files; false if one could not be.
+    bool finish() const {
+        bool ok = true;
+        if (!m_cfg.csvPath.empty()) ok &= writeCsv(m_cfg.csvPath);
+        if (!m_cfg.jsonPath.empty()) ok &= writeJson(m_cfg.jsonPath);
+        return ok;
+    }
+
+private:
+    static void summarize(Result& r) {
+        std::vector<double> s = r.seconds;
+        std::sort(s.begin(), s.end());
+        size_t n = s.size();
+        r.median = n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+        r.min = s.front();
+        double sum = 0;
+        for (double x : s) sum += x;
+        r.mean = sum / n;
+        double sq = 0;
+        for (double x : s) sq += (x - r.mean) * (x - r.mean);
+        r.stddev = n > 1 ? std::sqrt(sq / (n - 1)) : 0;
+    }
+
+    static std::string num(double v, int precision = 6) {
+        if (std::isnan(v)) return "";
+        std::ostringstream s;
+        s << std::setprecision(precision) << v;
+        return s.str();
+    }
+
+    static void print(const Result& r) {
+        std::string params;
+        for (auto& [name, value] : r.params) params += name + "=" + value + " ";
+        std::cout << std::left << std::setw(12) << r.kernel << std::setw(36) << params << std::fixed
+                  << std::setprecision(6) << std::setw(12) << r.median << std::setw(12) << r.min
+                  << std::setprecision(1) << std::setw(9) << (r.mean > 0 ? 100 * r.stddev / r.mean : 0)
+                  << std::defaultfloat << std::setw(9) << num(r.gbPerSec(), 3) << std::setw(7) << num(r.ipc(), 2)
+                  << std::setw(12) << num(r.counters[LLC_MISSES], 4) << num(r.counters[DTLB_MISSES], 4) << "\n";
+    }
+
+    bool writeCsv(const std::string& path) const {
+        std::ofstream f(path);
+        if (!f) return false;
+        // Cases may name different parameters; the columns are their union.
+        std::vector<std::string> names;
+        for (const Result& r : m_results)
+            for (auto& p : r.params)
+                if (std::find(names.begin(), names.end(), p.first) == names.end()) names.push_back(p.first);
+        f << "kernel";
+        for (auto& name : names) f << "," << name;
+        f << ",repetitions,median_s,min_s,mean_s,stddev_s,gb_per_s,ipc";
+        for (int c = 0; c < COUNTER_COUNT; c++) f << "," << counterName(c);
+        f << "\n";
+        for (const Result& r : m_results) {
+            f << r.kernel;
+            for (auto& name : names) {
+                f << ",";
+                for (auto& p : r.params)
+                    if (p.first == name) f << p.second;
+            }
+            f << "," << r.seconds.size() << "," << num(r.median, 9) << "," << num(r.min, 9) << ","
+              << num(r.mean, 9) << "," << num(r.stddev, 9) << "," << num(r.gbPerSec()) << "," << num(r.ipc(), 4);
+            for (double v : r.counters) f << "," << num(v, 12);
+            f << "\n";
+        }
+        return (bool)f;
+    }
+
+    bool writeJson(const std::string& path) const {
+        std::ofstream f(path);
+        if (!f) return false;
+        auto value = [](double v) { return std::isnan(v) ? std::string("null") : num(v, 12); };
+        f << "[\n";
+        for (size_t i = 0; i < m_results.size(); i++) {
+            const Result& r = m_results[i];
+            f << "  {\"kernel\": \"" << r.kernel << "\", \"params\": {";
+            for (size_t p = 0; p < r.params.size(); p++)
+                f << (p ? ", " : "") << "\"" << r.params[p].first << "\": \"" << r.params[p].second << "\"";
+            f << "}, \"seconds\": [";
+            for (size_t s = 0; s < r.seconds.size(); s++) f << (s ? ", " : "") << value(r.seconds[s]);
+            f << "], \"median\": " << value(r.median) << ", \"min\": " << value(r.min) << ", \"mean\": "
+              << value(r.mean) << ", \"stddev\": " << value(r.stddev) << ", \"gb_per_s\": " << value(r.gbPerSec())
+              << ", \"ipc\": " << value(r.ipc());
+            for (int c = 0; c < COUNTER_COUNT; c++) f << ", \"" << counterName(c) << "\": " << value(r.counters[c]);
+            f << "}" << (i + 1 < m_results.size() ? "," : "") << "\n";
+        }
+        f << "]\n";
+        return (bool)f;
+    }
+
+    Config m_cfg;
+    Counters m_counters;
+    bool m_haveCounters = false;
+    std::vector<Result> m_results;
+};
+
+}
@@ -2,11 +2,14 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
-#include <chrono>
 #include <random>
 #include <climits>
-#include <iomanip>
+#include <string>
 #include <algorithm>
+
+#include "bench.h"
+#include "scan.h"
+#include "summary.h"
 using namespace std;
 inline bool isOdd(int x) {
     return x % 2 != 0;
@@ -44,7 +47,8 @@ Result parallel_mutex(const int* a, size_t n, int threadsCount) {
             continue;
         }
 
-        threads[t] = thread([&, L, R]() {
+        threads[t] = thread([&, t, L, R]() {
+            bench::pinCurrentThread(t);
             Result local;
             for (size_t i = L; i < R; ++i)
                 if (isOdd(a[i])) {
@@ -81,7 +85,8 @@ Result parallel_atomic(const int* a, size_t n, int threadsCount) {
             continue;
         }
 
-        threads[t] = thread([&, L, R]() {
+        threads[t] = thread([&, t, L, R]() {
+            bench::pinCurrentThread(t);
             long long localSum = 0;
             int localMin = INT_MAX;
 
@@ -111,83 +116,174 @@ Result parallel_atomic(const int* a, size_t n, int threadsCount) {
     return r;
 }
 
-int main() {
+// Query `i` of a batch: lab2's own odd-sum and min-odd first, then a rotating
+// mix of other predicates and aggregates.
+scan::Query makeQuery(int i) {
+    using scan::Pred;
+    using scan::Agg;
+    const scan::Query mix[] = {
+        {Pred::Odd, Agg::Sum},
+        {Pred::Odd, Agg::Min},
+        {Pred::Even, Agg::Max},
+        {Pred::Between, Agg::Count, -1000, 1000},
+        {Pred::Greater, Agg::Sum, 500'000},
+        {Pred::Less, Agg::Min, -900'000},
+        {Pred::DivisibleBy, Agg::Count, 7},
+        {Pred::Any, Agg::Sum},
+    };
+    scan::Query q = mix[i % size(mix)];
+    q.a += i / (int)size(mix);  // later rounds ask slightly different questions
+    return q;
+}
+
+scan::MultiScan makeBatch(int count) {
+    scan::MultiScan batch;
+    for (int i = 0; i < count; i++) batch.add(makeQuery(i));
+    return batch;
+}
+
+// Mostly point writes with a few range adds of up to 1% of the array, the
+// shape of "changes a little between queries".
+vector<summary::Update> makeUpdates(size_t n, int count, mt19937& rng) {
+    vector<summary::Update> batch;
+    uniform_int_distribution<int> value(-1'000'000, 1'000'000);
+    uniform_int_distribution<int> delta(-50, 50);
+    for (int k = 0; k < count; k++) {
+        size_t l = rng() % n;
+        if (k % 10 == 9) {
+            size_t r = min(n, l + 1 + rng() % max<size_t>(1, n / 100));
+            batch.push_back({summary::Update::Add, l, r, delta(rng)});
+        } else {
+            batch.push_back({summary::Update::Set, l, l + 1, value(rng)});
+        }
+    }
+    return batch;
+}
+
+int main(int argc, char** argv) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
-    size_t sizes[] = {100'000, 1'000'000, 100'000'000};
-    int threadsList[] = {1, 2, 4, 8, 16, 32, 64};
+    bench::Config cfg;
+    cfg.sizes = {100'000, 1'000'000, 100'000'000};
+    cfg.threads = {1, 2, 4, 8, 16, 32, 64};
+    if (!bench::parseArgs(argc, argv, cfg))
+        return 1;
+    bench::Runner runner(cfg);
+    bool allOk = true;
 
     mt19937 rng(42);
     uniform_int_distribution<int> dist(-1'000'000, 1'000'000);
 
-    cout << left
-         << setw(12) << "Size"
-         << setw(10) << "Threads"
-         << setw(10) << "Mode"
-         << setw(14) << "Time(s)"
-         << setw(20) << "Sum"
-         << setw(10) << "MinOdd"
-         << "\n";
-    cout << string(76, '-') << "\n";
-
-    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
-        size_t n = sizes[s];
+    for (long long size : cfg.sizes) {
+        size_t n = (size_t)size;
         int* a = new int[n];
 
         for (size_t i = 0; i < n; ++i)
             a[i] = dist(rng);
 
-        auto t0 = chrono::high_resolution_clock::now();
-        Result r1 = sequential(a, n);
-        auto t1 = chrono::high_resolution_clock::now();
-        double timeSeq = chrono::duration<double>(t1 - t0).count();
-
-        cout << left
-             << setw(12) << n
-             << setw(10) << "-"
-             << setw(10) << "Seq"
-             << setw(14) << fixed << setprecision(6) << timeSeq
-             << setw(20) << r1.sum
-             << setw(10) << r1.minOdd
-             << "\n";
-
-        for (int T : threadsList) {
-            t0 = chrono::high_resolution_clock::now();
-            Result r2 = parallel_mutex(a, n, T);
-            t1 = chrono::high_resolution_clock::now();
-            double timeMutex = chrono::duration<double>(t1 - t0).count();
-
-            cout << left
-                 << setw(12) << n
-                 << setw(10) << T
-                 << setw(10) << "Mutex"
-                 << setw(14) << fixed << setprecision(6) << timeMutex
-                 << setw(20) << r2.sum
-                 << setw(10) << r2.minOdd
-                 << "\n";
+        // One pass over the array; the reductions touch nothing else.
+        double bytes = (double)n * sizeof(int);
+        string sizeName = to_string(n);
+
+        Result expected;
+        runner.run("seq", {{"size", sizeName}, {"threads", "1"}}, bytes, [&] { expected = sequential(a, n); });
+
+        auto check = [&](const char* mode, int T, const Result& r) {
+            if (r.sum == expected.sum && r.minOdd == expected.minOdd) return;
+            cerr << mode << " " << n << " x " << T << " threads: sum " << r.sum << " minOdd " << r.minOdd
+                 << ", expected " << expected.sum << " " << expected.minOdd << "\n";
+            allOk = false;
+        };
+
+        for (long long T : cfg.threads) {
+            Result r;
+            runner.run("mutex", {{"size", sizeName}, {"threads", to_string(T)}}, bytes,
+                       [&] { r = parallel_mutex(a, n, (int)T); });
+            check("mutex", (int)T, r);
         }
 
-        for (int T : threadsList) {
-            t0 = chrono::high_resolution_clock::now();
-            Result r3 = parallel_atomic(a, n, T);
-            t1 = chrono::high_resolution_clock::now();
-            double timeAtomic = chrono::duration<double>(t1 - t0).count();
-
-            cout << left
-                 << setw(12) << n
-                 << setw(10) << T
-                 << setw(10) << "Atomic"
-                 << setw(14) << fixed << setprecision(6) << timeAtomic
-                 << setw(20) << r3.sum
-                 << setw(10) << r3.minOdd
-                 << "\n";
+        for (long long T : cfg.threads) {
+            Result r;
+            runner.run("atomic", {{"size", sizeName}, {"threads", to_string(T)}}, bytes,
+                       [&] { r = parallel_atomic(a, n, (int)T); });
+            check("atomic", (int)T, r);
         }
 
-        cout << string(76, '-') << "\n";
+        // N queries fused into one blocked pass, against the same N queries
+        // as N one-query MultiScan passes and against N parallel_atomic
+        // sweeps. All declare N passes' worth of bytes, so the GB/s column
+        // reads as queries*GB/s: fused vs separate isolates what sharing the
+        // sweep buys, separate vs atomic what the vectorised kernels buy.
+        for (long long T : cfg.threads) {
+            for (int queries : {1, 8, 32}) {
+                bench::Params params = {
+                    {"size", sizeName}, {"threads", to_string(T)}, {"queries", to_string(queries)}};
+                scan::MultiScan batch = makeBatch(queries);
+                vector<scan::Answer> answers;
+                runner.run("multiscan", params, bytes * queries, [&] { answers = batch.run(a, n, (int)T); });
+                if (answers[0].value != expected.sum || (queries > 1 && answers[1].value != expected.minOdd)) {
+                    cerr << "multiscan " << n << " x " << queries << " queries: wrong odd sum/min\n";
+                    allOk = false;
+                }
+
+                vector<scan::MultiScan> singles(queries);
+                for (int q = 0; q < queries; q++) singles[q].add(makeQuery(q));
+                runner.run("multiscan*N", params, bytes * queries, [&] {
+                    for (int q = 0; q < queries; q++) answers[q] = singles[q].run(a, n, (int)T)[0];
+                });
+                if (answers[0].value != expected.sum || (queries > 1 && answers[1].value != expected.minOdd)) {
+                    cerr << "multiscan*N " << n << " x " << queries << " queries: wrong odd sum/min\n";
+                    allOk = false;
+                }
+
+                Result r;
+                runner.run("atomic*N", params, bytes * queries, [&] {
+                    for (int q = 0; q < queries; q++) r = parallel_atomic(a, n, (int)T);
+                });
+                check("atomic*N", (int)T, r);
+            }
+        }
+
+        // The same update batches applied to an indexed summary and to a plain
+        // copy that is rescanned afterwards; each pass ends with the
+        // whole-array answer and one range query. Both are rebuilt from `a`
+        // for every thread count.
+        for (long long T : cfg.threads) {
+            summary::OddSummary indexed(a, n, (int)T);
+            vector<int> plain(a, a + n);
+            for (int updates : {16, 1024}) {
+                bench::Params params = {
+                    {"size", sizeName}, {"threads", to_string(T)}, {"updates", to_string(updates)}};
+                mt19937 batchRng(updates);
+                vector<summary::Update> batch = makeUpdates(n, updates, batchRng);
+                size_t l = batchRng() % n, r = l + batchRng() % (n - l + 1);
+                summary::OddAggregate total, range;
+                runner.run("summary", params, 0, [&] {
+                    indexed.apply(batch, (int)T);
+                    total = indexed.total();
+                    range = indexed.query(l, r);
+                });
+                Result full, part;
+                runner.run("rescan", params, bytes, [&] {
+                    for (const summary::Update& u : batch)
+                        for (size_t i = u.l; i < u.r; i++)
+                            plain[i] = u.kind == summary::Update::Set ? u.value : plain[i] + u.value;
+                    full = parallel_atomic(plain.data(), n, (int)T);
+                    part = sequential(plain.data() + l, r - l);
+                });
+                auto same = [](const summary::OddAggregate& x, const Result& y) {
+                    return x.sum == y.sum && (x.minOdd == LLONG_MAX ? y.minOdd == INT_MAX : x.minOdd == y.minOdd);
+                };
+                if (!same(total, full) || !same(range, part)) {
+                    cerr << "summary " << n << " x " << updates << " updates: disagrees with rescan\n";
+                    allOk = false;
+                }
+            }
+        }
 
         delete[] a;
     }
 
-    return 0;
+    return runner.finish() && allOk ? 0 : 1;
 }
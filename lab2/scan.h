@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+
+// Single-pass evaluation of many filter + aggregate queries over one array.
+// The array is walked once in cache-sized blocks and every registered query
+// runs over a block while it is still in L1/L2, so N queries cost one sweep
+// of memory instead of N. Threads take contiguous ranges, like
+// parallel_atomic, and keep private accumulators that are merged at the end.
+//
+// Predicates and aggregates are plain data rather than callbacks: each
+// (predicate, aggregate) pair is a template instantiation picked once at
+// registration, so the per-element loop has no indirect calls or branches on
+// the query kind and the compiler is free to vectorise it.
+namespace scan {
+
+enum class Pred { Any, Odd, Even, Less, Greater, Between, DivisibleBy };
+enum class Agg { Sum, Min, Max, Count };
+
+struct Query {
+    Pred pred;
+    Agg agg;
+    int a = 0;  // Less/Greater/DivisibleBy operand, Between lower bound
+    int b = 0;  // Between upper bound (inclusive)
+};
+
+// `matched` counts the elements the predicate let through, so a Min or Max
+// over no elements can be told from a real INT_MAX or INT_MIN.
+struct Answer {
+    long long value = 0;
+    long long matched = 0;
+};
+
+template <Pred P>
+inline bool test(int x, const Query& q) {
+    if constexpr (P == Pred::Any) return true;
+    else if constexpr (P == Pred::Odd) return x % 2 != 0;
+    else if constexpr (P == Pred::Even) return x % 2 == 0;
+    else if constexpr (P == Pred::Less) return x < q.a;
+    else if constexpr (P == Pred::Greater) return x > q.a;
+    else if constexpr (P == Pred::Between) return x >= q.a && x <= q.b;
+    else return x % q.a == 0;
+}
+
+inline long long identity(Agg agg) {
+    switch (agg) {
+    case Agg::Min: return LLONG_MAX;
+    case Agg::Max: return LLONG_MIN;
+    default: return 0;
+    }
+}
+
+template <Pred P, Agg A>
+void scanBlock(const int* p, size_t len, const Query& q, Answer& acc) {
+    long long value = acc.value;
+    long long matched = 0;
+    for (size_t i = 0; i < len; i++) {
+        int x = p[i];
+        bool hit = test<P>(x, q);
+        matched += hit;
+        if constexpr (A == Agg::Sum) value += hit ? x : 0;
+        else if constexpr (A == Agg::Min) value = hit && x < value ? x : value;
+        else if constexpr (A == Agg::Max) value = hit && x > value ? x : value;
+    }
+    acc.value = A == Agg::Count ? acc.value + matched : value;
+    acc.matched += matched;
+}
+
+using BlockFn = void (*)(const int*, size_t, const Query&, Answer&);
+
+template <Pred P>
+BlockFn pickAgg(Agg agg) {
+    switch (agg) {
+    case Agg::Sum: return scanBlock<P, Agg::Sum>;
+    case Agg::Min: return scanBlock<P, Agg::Min>;
+    case Agg::Max: return scanBlock<P, Agg::Max>;
+    default: return scanBlock<P, Agg::Count>;
+    }
+}
+
+inline BlockFn pick(const Query& q) {
+    switch (q.pred) {
+    case Pred::Any: return pickAgg<Pred::Any>(q.agg);
+    case Pred::Odd: return pickAgg<Pred::Odd>(q.agg);
+    case Pred::Even: return pickAgg<Pred::Even>(q.agg);
+    case Pred::Less: return pickAgg<Pred::Less>(q.agg);
+    case Pred::Greater: return pickAgg<Pred::Greater>(q.agg);
+    case Pred::Between: return pickAgg<Pred::Between>(q.agg);
+    default: return pickAgg<Pred::DivisibleBy>(q.agg);
+    }
+}
+
+inline void merge(Agg agg, Answer& into, const Answer& from) {
+    switch (agg) {
+    case Agg::Min: into.value = std::min(into.value, from.value); break;
+    case Agg::Max: into.value = std::max(into.value, from.value); break;
+    default: into.value += from.value; break;
+    }
+    into.matched += from.matched;
+}
+
+class MultiScan {
+public:
+    // 16K ints is 64 KB: past most L1s, but comfortably inside L2, and long
+    // enough that the per-block loop over queries is noise.
+    explicit MultiScan(size_t blockElems = 16 * 1024) : m_block(blockElems) {}
+
+    // Returns the query's index in the answers of run(). The two DivisibleBy
+    // operands `x % a` can't evaluate are rewritten to what they mean: only 0
+    // is a multiple of 0, and everything is a multiple of -1 (INT_MIN % -1
+    // overflows).
+    size_t add(Query q) {
+        if (q.pred == Pred::DivisibleBy && q.a == 0) q = {Pred::Between, q.agg, 0, 0};
+        else if (q.pred == Pred::DivisibleBy && q.a == -1) q.a = 1;
+        m_queries.push_back(q);
+        m_fns.push_back(pick(q));
+        return m_queries.size() - 1;
+    }
+
+    size_t size() const { return m_queries.size(); }
+
+    std::vector<Answer> run(const int* a, size_t n, int threadsCount) const {
+        if (threadsCount < 1) threadsCount = 1;
+        size_t q = m_queries.size();
+        std::vector<std::vector<Answer>> partial(threadsCount, fresh());
+        std::vector<std::thread> threads;
+        size_t chunk = (n + threadsCount - 1) / threadsCount;
+        for (int t = 0; t < threadsCount; ++t) {
+            size_t L = static_cast<size_t>(t) * chunk;
+            size_t R = std::min(n, L + chunk);
+            if (L >= n) break;
+            threads.emplace_back([&, t, L, R]() {
+                bench::pinCurrentThread(t);
+                std::vector<Answer>& acc = partial[t];
+                for (size_t b = L; b < R; b += m_block) {
+                    size_t len = std::min(m_block, R - b);
+                    for (size_t i = 0; i < q; i++) m_fns[i](a + b, len, m_queries[i], acc[i]);
+                }
+            });
+        }
+        for (auto& th : threads) th.join();
+
+        std::vector<Answer> out = fresh();
+        for (const auto& acc : partial)
+            for (size_t i = 0; i < q; i++) merge(m_queries[i].agg, out[i], acc[i]);
+        return out;
+    }
+
+private:
+    std::vector<Answer> fresh() const {
+        std::vector<Answer> v(m_queries.size());
+        for (size_t i = 0; i < v.size(); i++) v[i].value = identity(m_queries[i].agg);
+        return v;
+    }
+
+    size_t m_block;
+    std::vector<Query> m_queries;
+    std::vector<BlockFn> m_fns;
+};
+
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+
+// Incrementally maintained odd-sum / min-odd for an array that changes a
+// little between queries. The array is cut into BLOCK-element blocks, every
+// block keeps the sum, min and count of both its odd and its even elements,
+// and a segment tree over the blocks combines the odd halves. The whole
+// array is then answered from the root in O(1) and any range in
+// O(BLOCK + log blocks), instead of a full rescan.
+//
+// Updates come in ordered batches of point or range Set and Add. A batch is
+// applied in parallel by giving every thread a contiguous run of blocks; each
+// thread walks the whole batch in order and applies only the parts that fall
+// into its blocks, so per-element order is kept without locks. An Add that
+// covers a whole block is O(1): the block's stats shift by the delta, its odd
+// and even halves trade places when the delta is odd, and the delta is kept
+// pending until something needs the block's elements. Everything else writes
+// elements and rescans just the blocks it touched. Only tree paths above
+// changed blocks are recomputed afterwards.
+namespace summary {
+
+struct Update {
+    enum Kind { Set, Add } kind;
+    size_t l, r;  // [l, r); a point update has r == l + 1
+    int value;
+};
+
+struct OddAggregate {
+    long long sum = 0;
+    long long minOdd = LLONG_MAX;  // LLONG_MAX when the range has no odd element
+};
+
+class OddSummary {
+public:
+    static constexpr size_t BLOCK = 1024;
+
+    OddSummary(const int* a, size_t n, int threadsCount)
+        : m_n(n), m_values(a, a + n), m_blocks((n + BLOCK - 1) / BLOCK) {
+        m_leaves.resize(m_blocks);
+        m_base = 1;
+        while (m_base < std::max<size_t>(m_blocks, 1)) m_base *= 2;
+        m_tree.assign(2 * m_base, OddAggregate{});
+        forBlocks(threadsCount, [&](int, size_t b0, size_t b1) {
+            for (size_t b = b0; b < b1; b++) rescan(b);
+        });
+        for (size_t b = 0; b < m_blocks; b++) m_tree[m_base + b] = oddOf(m_leaves[b]);
+        for (size_t i = m_base - 1; i >= 1; i--) m_tree[i] = combine(m_tree[2 * i], m_tree[2 * i + 1]);
+    }
+
+    void apply(const std::vector<Update>& batch, int threadsCount) {
+        std::vector<std::vector<size_t>> changed(std::max(threadsCount, 1));
+        forBlocks(threadsCount, [&](int t, size_t b0, size_t b1) {
+            std::vector<char> dirty(b1 - b0, 0);
+            size_t lo = b0 * BLOCK, hi = std::min(b1 * BLOCK, m_n);
+            for (const Update& u : batch) {
+                size_t l = std::max(u.l, lo), r = std::min(u.r, hi);
+                for (size_t b = l / BLOCK; l < r; b++) {
+                    size_t end = std::min(r, (b + 1) * BLOCK);
+                    bool whole = l == b * BLOCK && end == std::min((b + 1) * BLOCK, m_n);
+                    if (u.kind == Update::Add && whole && dirty[b - b0] != 1) {
+                        shift(m_leaves[b], u.value);
+                        dirty[b - b0] = 2;
+                    } else {
+                        flush(b);
+                        for (size_t i = l; i < end; i++)
+                            m_values[i] = u.kind == Update::Set ? u.value : m_values[i] + u.value;
+                        dirty[b - b0] = 1;
+                    }
+                    l = end;
+                }
+            }
+            // 1: elements changed, rescan; 2: stats already shifted in place.
+            for (size_t b = b0; b < b1; b++) {
+                if (!dirty[b - b0]) continue;
+                if (dirty[b - b0] == 1) rescan(b);
+                changed[t].push_back(b);
+            }
+        });
+
+        std::vector<size_t> nodes;
+        for (auto& list : changed)
+            for (size_t b : list) {
+                m_tree[m_base + b] = oddOf(m_leaves[b]);
+                nodes.push_back((m_base + b) / 2);
+            }
+        // Lists arrive in block order, so each level only needs adjacent
+        // duplicates removed on the way up.
+        while (!nodes.empty() && nodes.front() > 0) {
+            nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+            for (size_t& i : nodes) {
+                m_tree[i] = combine(m_tree[2 * i], m_tree[2 * i + 1]);
+                i /= 2;
+            }
+        }
+    }
+
+    OddAggregate total() const { return m_tree[1]; }
+
+    // Odd sum and min over [l, r).
+    OddAggregate query(size_t l, size_t r) const {
+        r = std::min(r, m_n);
+        OddAggregate out;
+        if (l >= r) return out;
+        size_t bl = (l + BLOCK - 1) / BLOCK, br = r / BLOCK;
+        if (bl >= br) return scanElems(l, r);
+        out = combine(scanElems(l, bl * BLOCK), scanElems(br * BLOCK, r));
+        for (size_t i = bl + m_base, j = br + m_base; i < j; i /= 2, j /= 2) {
+            if (i & 1) out = combine(out, m_tree[i++]);
+            if (j & 1) out = combine(out, m_tree[--j]);
+        }
+        return out;
+    }
+
+    int get(size_t i) const { return (int)(m_values[i] + m_leaves[i / BLOCK].pending); }
+
+private:
+    struct Parity {
+        long long sum = 0;
+        long long min = LLONG_MAX;
+        size_t count = 0;
+    };
+
+    struct Leaf {
+        Parity odd, even;
+        long long pending = 0;  // added to the block's stats but not yet to its elements
+    };
+
+    static OddAggregate combine(const OddAggregate& a, const OddAggregate& b) {
+        return {a.sum + b.sum, std::min(a.minOdd, b.minOdd)};
+    }
+
+    static OddAggregate oddOf(const Leaf& leaf) { return {leaf.odd.sum, leaf.odd.min}; }
+
+    static void shift(Leaf& leaf, int delta) {
+        for (Parity* p : {&leaf.odd, &leaf.even}) {
+            p->sum += (long long)delta * (long long)p->count;
+            if (p->count) p->min += delta;
+        }
+        if (delta % 2 != 0) std::swap(leaf.odd, leaf.even);
+        leaf.pending += delta;
+    }
+
+    void flush(size_t b) {
+        Leaf& leaf = m_leaves[b];
+        if (!leaf.pending) return;
+        for (size_t i = b * BLOCK, end = std::min(m_n, i + BLOCK); i < end; i++)
+            m_values[i] = (int)(m_values[i] + leaf.pending);
+        leaf.pending = 0;
+    }
+
+    void rescan(size_t b) {
+        Leaf& leaf = m_leaves[b];
+        flush(b);
+        leaf.odd = leaf.even = Parity{};
+        for (size_t i = b * BLOCK, end = std::min(m_n, i + BLOCK); i < end; i++) {
+            int x = m_values[i];
+            Parity& p = x % 2 != 0 ? leaf.odd : leaf.even;
+            p.sum += x;
+            p.min = std::min(p.min, (long long)x);
+            p.count++;
+        }
+    }
+
+    OddAggregate scanElems(size_t l, size_t r) const {
+        OddAggregate out;
+        for (size_t i = l; i < r; i++) {
+            int x = get(i);
+            if (x % 2 != 0) {
+                out.sum += x;
+                out.minOdd = std::min(out.minOdd, (long long)x);
+            }
+        }
+        return out;
+    }
+
+    // Runs f(thread, firstBlock, endBlock) over contiguous runs of blocks.
+    template <class F>
+    void forBlocks(int threadsCount, F&& f) {
+        if (threadsCount < 1) threadsCount = 1;
+        std::vector<std::thread> threads;
+        size_t chunk = (m_blocks + threadsCount - 1) / threadsCount;
+        for (int t = 0; t < threadsCount; ++t) {
+            size_t b0 = static_cast<size_t>(t) * chunk;
+            size_t b1 = std::min(m_blocks, b0 + chunk);
+            if (b0 >= m_blocks) break;
+            threads.emplace_back([&, t, b0, b1]() {
+                bench::pinCurrentThread(t);
+                f(t, b0, b1);
+            });
+        }
+        for (auto& th : threads) th.join();
+    }
+
+    size_t m_n;
+    std::vector<int> m_values;
+    size_t m_blocks;
+    std::vector<Leaf> m_leaves;
+    size_t m_base = 1;
+    std::vector<OddAggregate> m_tree;  // 1-based; leaves at m_base + block
+};
+
+}
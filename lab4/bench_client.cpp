@@ -0,0 +1,308 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <stdexcept>
+
+#include "protocol.h"
+
+using namespace std;
+using namespace chrono;
+
+// Non-interactive load generator for the transpose server. Every connection
+// runs full sessions (HELLO, upload, transpose, results, QUIT) back to back
+// and the latency of each protocol phase is written in the same CSV layout as
+// Locust's result_stats.csv, so lab4 and lab5 runs can be read side by side.
+//
+// Matrices are seeded from --seed (random unless given, and printed either
+// way): a rerun against the same server process would otherwise find every
+// matrix in the server's content-hash timing cache and time lookups instead
+// of transposes. With --repeat-matrices R, sessions cycle through R matrices
+// per run, so --by-hash uploads and cached timings actually get hit.
+
+struct Options {
+    string host = "127.0.0.1";
+    int port = PORT;
+    int connections = 4;
+    int sessions = 5;
+    vector<int> sizes = {500, 1000, 2000};
+    vector<int> threads = {1, 2, 4};
+    bool byHash = false;
+    unsigned seed = random_device{}();
+    int repeatMatrices = 0;  // distinct matrices per run; 0 = one per session
+    string csvPrefix = "bench";
+};
+
+// Whole-string integer parse within [lo, hi]; throws invalid_argument or
+// out_of_range on anything else, trailing junk included.
+long long parseNumber(const string& s, long long lo, long long hi) {
+    size_t used = 0;
+    long long v = stoll(s, &used);
+    if (used != s.size()) throw invalid_argument(s);
+    if (v < lo || v > hi) throw out_of_range(s);
+    return v;
+}
+
+int parseInt(const string& s) { return (int)parseNumber(s, INT_MIN, INT_MAX); }
+
+vector<int> parseList(const string& s) {
+    vector<int> out;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ','))
+        if (!item.empty()) out.push_back(parseInt(item));
+    return out;
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+    auto usage = [] {
+        cerr << "usage: bench_client [--host H] [--port P] [--connections M] [--sessions K]\n"
+                "                    [--sizes 500,1000] [--threads 1,2,4] [--by-hash] [--csv prefix]\n"
+                "                    [--seed S] [--repeat-matrices R]\n";
+        return false;
+    };
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            auto value = [&]() -> string { return i + 1 < argc ? argv[++i] : ""; };
+            if (arg == "--host") o.host = value();
+            else if (arg == "--port") o.port = parseInt(value());
+            else if (arg == "--connections") o.connections = parseInt(value());
+            else if (arg == "--sessions") o.sessions = parseInt(value());
+            else if (arg == "--sizes") o.sizes = parseList(value());
+            else if (arg == "--threads") o.threads = parseList(value());
+            else if (arg == "--by-hash") o.byHash = true;
+            else if (arg == "--seed") o.seed = (unsigned)parseNumber(value(), 0, UINT_MAX);
+            else if (arg == "--repeat-matrices") o.repeatMatrices = parseInt(value());
+            else if (arg == "--csv") o.csvPrefix = value();
+            else return usage();
+        }
+    } catch (const logic_error&) {  // invalid_argument, out_of_range
+        return usage();
+    }
+    bool sizesOk = !o.sizes.empty() && all_of(o.sizes.begin(), o.sizes.end(), [](int n) { return n > 0; });
+    if (o.port <= 0 || o.port > 65535 || o.connections <= 0 || o.sessions <= 0 || !sizesOk || o.threads.empty() ||
+        o.repeatMatrices < 0)
+        return usage();
+    return true;
+}
+
+struct PhaseStats {
+    vector<double> ms;
+    size_t failures = 0;
+    double bytes = 0;
+};
+
+class StatsTable {
+public:
+    void record(const string& name, double ms, size_t bytes, bool ok) {
+        lock_guard<mutex> lock(m_mutex);
+        PhaseStats& ps = m_phases[name];
+        ps.ms.push_back(ms);
+        ps.bytes += bytes;
+        if (!ok) ps.failures++;
+    }
+
+    void writeCsv(const string& path, double wallSec) {
+        ofstream f(path);
+        f.precision(10);
+        f << "Type,Name,Request Count,Failure Count,Median Response Time,Average Response Time,"
+             "Min Response Time,Max Response Time,Average Content Size,Requests/s,Failures/s,"
+             "50%,66%,75%,80%,90%,95%,98%,99%,99.9%,99.99%,100%\n";
+        PhaseStats all;
+        for (auto& [name, ps] : m_phases) {
+            writeRow(f, "TCP", name, ps, wallSec);
+            all.ms.insert(all.ms.end(), ps.ms.begin(), ps.ms.end());
+            all.failures += ps.failures;
+            all.bytes += ps.bytes;
+        }
+        writeRow(f, "", "Aggregated", all, wallSec);
+    }
+
+    void print(double wallSec) {
+        cout << left << setw(22) << "Phase" << setw(8) << "Count" << setw(8) << "Fail"
+             << setw(12) << "p50 (ms)" << setw(12) << "p99 (ms)" << setw(12) << "max (ms)"
+             << setw(10) << "req/s" << "MB/s\n";
+        cout << string(90, '-') << "\n";
+        for (auto& [name, ps] : m_phases) {
+            vector<double> v = ps.ms;
+            sort(v.begin(), v.end());
+            cout << left << setw(22) << name << setw(8) << v.size() << setw(8) << ps.failures
+                 << setw(12) << fixed << setprecision(2) << percentile(v, 0.5)
+                 << setw(12) << percentile(v, 0.99) << setw(12) << v.back()
+                 << setw(10) << v.size() / wallSec << ps.bytes / wallSec / 1e6 << "\n";
+        }
+    }
+
+private:
+    static double percentile(const vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t idx = (size_t)ceil(p * sorted.size());
+        return sorted[min(sorted.size() - 1, idx == 0 ? 0 : idx - 1)];
+    }
+
+    static void writeRow(ofstream& f, const string& type, const string& name, const PhaseStats& ps, double wallSec) {
+        vector<double> v = ps.ms;
+        sort(v.begin(), v.end());
+        double sum = 0;
+        for (double x : v) sum += x;
+        size_t count = v.size();
+        f << type << "," << name << "," << count << "," << ps.failures << ","
+          << percentile(v, 0.5) << "," << (count ? sum / count : 0) << ","
+          << (count ? v.front() : 0) << "," << (count ? v.back() : 0) << ","
+          << (count ? ps.bytes / count : 0) << "," << count / wallSec << "," << ps.failures / wallSec;
+        for (double p : {0.5, 0.66, 0.75, 0.8, 0.9, 0.95, 0.98, 0.99, 0.999, 0.9999, 1.0})
+            f << "," << percentile(v, p);
+        f << "\n";
+    }
+
+    mutex m_mutex;
+    map<string, PhaseStats> m_phases;
+};
+
+StatsTable g_stats;
+atomic<size_t> g_sessionsFailed{0};
+
+int connectTo(const Options& o) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    sockaddr_in srv{};
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(o.port);
+    srv.sin_addr.s_addr = inet_addr(o.host.c_str());
+    if (connect(s, (sockaddr*)&srv, sizeof(srv)) < 0) {
+        close(s);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+double msSince(steady_clock::time_point t) {
+    return duration<double, milli>(steady_clock::now() - t).count();
+}
+
+// Waits for `expected`, skipping the asynchronous INFO/PROGRESS pushes.
+bool awaitReply(int s, const string& expected, string& reply) {
+    while (receiveCommand(s, reply)) {
+        if (reply.rfind(expected, 0) == 0) return true;
+        if (reply.rfind("ERROR", 0) == 0 || reply == "JOB_CANCELLED") return false;
+    }
+    return false;
+}
+
+bool runSession(const Options& o, int n, unsigned seed) {
+    auto sessionStart = steady_clock::now();
+    string tag = "/" + to_string(n);
+    string reply;
+    int s = connectTo(o);
+    if (s < 0) {
+        g_stats.record("session" + tag, msSince(sessionStart), 0, false);
+        return false;
+    }
+    sendCommand(s, "HELLO");
+    bool ok = awaitReply(s, "WELCOME", reply);
+
+    mt19937 rng(seed);
+    vector<int32_t> flat((size_t)n * n);
+    for (int32_t& v : flat) v = htonl((int32_t)(rng() % 100));
+    size_t payload = flat.size() * sizeof(int32_t);
+    MatrixUploadInfo hdr{htonl(n), htonl((uint32_t)o.threads.size()), htonl((uint32_t)payload)};
+    vector<int32_t> cfgNet;
+    for (int t : o.threads) cfgNet.push_back(htonl(t));
+
+    if (ok) {
+        auto t = steady_clock::now();
+        bool sent = false;
+        if (o.byHash) {
+            sendCommand(s, "UPLOAD_BY_HASH");
+            sendAll(s, (char*)&hdr, sizeof(hdr));
+            sendAll(s, (char*)cfgNet.data(), cfgNet.size() * 4);
+            sendHash(s, matrixHash((char*)flat.data(), payload));
+            ok = receiveCommand(s, reply);
+            sent = ok && reply == "MATRIX_RECEIVED";
+        }
+        if (ok && !sent) {
+            sendCommand(s, "UPLOAD_MATRIX");
+            sendAll(s, (char*)&hdr, sizeof(hdr));
+            sendAll(s, (char*)cfgNet.data(), cfgNet.size() * 4);
+            ok = sendAll(s, (char*)flat.data(), (int)payload) == (int)payload &&
+                 awaitReply(s, "MATRIX_RECEIVED", reply);
+        }
+        // Bytes count only once the server has acknowledged them. A hash hit
+        // is a different operation from an upload and is timed on its own.
+        g_stats.record((sent ? "upload_hit" : "upload") + tag, msSince(t), ok && !sent ? payload : 0, ok);
+    }
+    if (ok) {
+        auto t = steady_clock::now();
+        sendCommand(s, "START_TRANSPOSE");
+        ok = awaitReply(s, "TRANSPOSE_COMPLETED", reply);
+        g_stats.record("transpose" + tag, msSince(t), 0, ok);
+    }
+    if (ok) {
+        auto t = steady_clock::now();
+        sendCommand(s, "REQUEST_RESULTS");
+        ok = awaitReply(s, "RESULT:", reply);
+        g_stats.record("results" + tag, msSince(t), reply.size(), ok);
+    }
+    sendCommand(s, "QUIT");
+    awaitReply(s, "BYE", reply);
+    close(s);
+    g_stats.record("session" + tag, msSince(sessionStart), 0, ok);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) return 1;
+
+    cout << "[bench] " << o.connections << " connections x " << o.sessions << " sessions against "
+         << o.host << ":" << o.port << ", seed " << o.seed;
+    if (o.repeatMatrices > 0) cout << ", " << o.repeatMatrices << " matrices repeated";
+    cout << "\n";
+
+    auto start = steady_clock::now();
+    vector<thread> workers;
+    for (int c = 0; c < o.connections; c++) {
+        workers.emplace_back([&o, c] {
+            for (int k = 0; k < o.sessions; k++) {
+                // A repeated matrix keeps its size, so it really is the same.
+                int matrix = c * o.sessions + k;
+                int n = o.sizes[(c + k) % o.sizes.size()];
+                if (o.repeatMatrices > 0) {
+                    matrix %= o.repeatMatrices;
+                    n = o.sizes[matrix % o.sizes.size()];
+                }
+                if (!runSession(o, n, o.seed + (unsigned)matrix))
+                    g_sessionsFailed++;
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    double wallSec = duration<double>(steady_clock::now() - start).count();
+
+    g_stats.print(wallSec);
+    string path = o.csvPrefix + "_stats.csv";
+    g_stats.writeCsv(path, wallSec);
+    cout << "\n[bench] " << o.connections * o.sessions << " sessions in " << fixed << setprecision(2)
+         << wallSec << " s, " << g_sessionsFailed.load() << " failed, stats in " << path << "\n";
+    return g_sessionsFailed ? 1 : 0;
+}
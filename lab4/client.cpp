@@ -1,7 +1,11 @@
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -9,78 +13,233 @@
 #include <chrono>
 #include <sstream>
 #include <string>
+#include <cstring>
 #include <limits>
 
+#include "protocol.h"
+#include "codec.h"
+
 using namespace std;
 
-struct CommandPacket {
-    uint32_t length;
-    char command[256];
-};
-
-struct MatrixUploadInfo {
-    uint32_t matrix_size;
-    uint32_t num_configs;
-    uint32_t matrix_bytes;
-};
-
-int recvAll(int s, char* buffer, int length) {
-    int received = 0;
-    while (received < length) {
-        int n = recv(s, buffer + received, length - received, 0);
-        if (n <= 0) return -1;
-        received += n;
-    }
-    return received;
+bool sendFd(int s, int fd) {
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(fd));
+    return sendmsg(s, &msg, 0) == 1;
 }
 
-int sendAll(int s, const char* data, int length) {
-    int sent = 0;
-    while (sent < length) {
-        int n = send(s, data + sent, length - sent, 0);
-        if (n <= 0) return -1;
-        sent += n;
+int createSharedSegment(size_t bytes) {
+#ifdef __linux__
+    int fd = memfd_create("lab4_matrix", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    string name = "/lab4_matrix_" + to_string(getpid());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) shm_unlink(name.c_str());
+#endif
+    if (fd < 0) return -1;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) < 0) {
+        close(fd);
+        return -1;
     }
-    return sent;
-}
-
-bool sendCommand(int s, const string& cmd) {
-    if (cmd.size() > 256) return false;
-    CommandPacket pkt{};
-    pkt.length = htonl(static_cast<uint32_t>(cmd.size()));
-    memcpy(pkt.command, cmd.data(), cmd.size());
-    return sendAll(s, reinterpret_cast<char*>(&pkt), sizeof(pkt)) == sizeof(pkt);
+#ifdef __linux__
+    // The server maps only segments that can no longer change size.
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        close(fd);
+        return -1;
+    }
+#endif
+    return fd;
 }
 
-bool receiveCommand(int s, string& outCmd) {
-    CommandPacket pkt{};
-    if (recvAll(s, reinterpret_cast<char*>(&pkt), sizeof(pkt)) != sizeof(pkt)) return false;
-    uint32_t len = ntohl(pkt.length);
-    if (len > 256) return false;
-    outCmd.assign(pkt.command, pkt.command + len);
-    return true;
+int connectLocal() {
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SHM_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
 }
 
-int main() {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
+int connectTcp(int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
         perror("socket");
-        return 1;
+        return -1;
     }
     sockaddr_in srv{};
     srv.sin_family = AF_INET;
-    srv.sin_port = htons(12345);
+    srv.sin_port = htons(port);
     srv.sin_addr.s_addr = inet_addr("127.0.0.1");
-    if (connect(sockfd, reinterpret_cast<sockaddr*>(&srv), sizeof(srv)) < 0) {
+    if (connect(s, reinterpret_cast<sockaddr*>(&srv), sizeof(srv)) < 0) {
         perror("connect");
-        close(sockfd);
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// Encodes the payload per HASH_CHUNK on all cores. Every chunk gets the
+// smallest of the candidate encodings, and goes raw if none of them shrinks it.
+vector<vector<char>> encodePayload(const char* payload, size_t bytes, const vector<uint32_t>& candidates,
+                                   vector<uint32_t>& encodings) {
+    size_t chunks = (bytes + HASH_CHUNK - 1) / HASH_CHUNK;
+    vector<vector<char>> out(chunks);
+    encodings.assign(chunks, ENC_RAW);
+    unsigned workers = max(1u, thread::hardware_concurrency());
+    vector<thread> threads;
+    for (unsigned w = 0; w < workers; w++) {
+        threads.emplace_back([&, w] {
+            for (size_t k = w; k < chunks; k += workers) {
+                const char* raw = payload + k * HASH_CHUNK;
+                size_t len = min(HASH_CHUNK, bytes - k * HASH_CHUNK);
+                for (uint32_t enc : candidates) {
+                    vector<char> data = encodeChunk(enc, raw, len);
+                    if (data.size() < len && (out[k].empty() || data.size() < out[k].size())) {
+                        out[k] = move(data);
+                        encodings[k] = enc;
+                    }
+                }
+                if (encodings[k] == ENC_RAW)
+                    out[k].assign(raw, raw + len);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    return out;
+}
+
+// Streams the matrix in blockRows-row blocks and reads the transpose back the
+// same way; the server transposes tiles while later blocks are still in flight.
+int runStreaming(int sockfd, int n, int threads, int blockRows) {
+    vector<int32_t> matrix(static_cast<size_t>(n) * n);
+    for (int32_t& v : matrix) v = rand() % 100;
+
+    auto start = chrono::steady_clock::now();
+    StreamInfo info{};
+    info.matrix_size = htonl(n);
+    info.threads = htonl(threads);
+    info.block_rows = htonl(blockRows);
+    sendCommand(sockfd, "STREAM_TRANSPOSE");
+    sendAll(sockfd, reinterpret_cast<char*>(&info), sizeof(info));
+    string reply;
+    if (!receiveCommand(sockfd, reply) || reply != "STREAM_READY") {
+        cout << "[server] " << reply << "\n";
         return 1;
     }
-    cout << "[client] Connected\n";
+    vector<int32_t> block(static_cast<size_t>(blockRows) * n);
+    for (int r = 0; r < n; r += blockRows) {
+        size_t count = static_cast<size_t>(min(blockRows, n - r)) * n;
+        for (size_t k = 0; k < count; ++k)
+            block[k] = htonl(matrix[static_cast<size_t>(r) * n + k]);
+        sendAll(sockfd, reinterpret_cast<char*>(block.data()), static_cast<int>(count * sizeof(int32_t)));
+    }
+
+    bool ok = true;
+    int rowsReceived = 0;
+    while (receiveCommand(sockfd, reply)) {
+        if (reply != "RESULT_BLOCK") {
+            cout << "[server] " << reply << "\n";
+            break;
+        }
+        StreamBlockHeader hdr{};
+        recvAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+        int rowStart = static_cast<int>(ntohl(hdr.row_start));
+        int rows = static_cast<int>(ntohl(hdr.rows));
+        int bytes = rows * n * static_cast<int>(sizeof(int32_t));
+        if (rowStart < 0 || rows <= 0 || rowStart + rows > n || rows > blockRows ||
+            recvAll(sockfd, reinterpret_cast<char*>(block.data()), bytes) != bytes)
+            return 1;
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < n; ++j)
+                if (static_cast<int32_t>(ntohl(block[static_cast<size_t>(i) * n + j])) !=
+                    matrix[static_cast<size_t>(j) * n + rowStart + i])
+                    ok = false;
+        rowsReceived += rows;
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "[client] streamed " << n << "x" << n << " with " << threads << " threads in " << sec
+         << " s, check: " << (ok && rowsReceived == n ? "OK" : "ERROR") << "\n";
+    sendCommand(sockfd, "QUIT");
+    close(sockfd);
+    return ok && rowsReceived == n ? 0 : 1;
+}
+
+// Takes over a job left behind by an earlier connection (its id came with
+// TRANSPOSE_STARTED), waits for it to finish and prints its results.
+int runAttach(int sockfd, const string& jobId) {
+    string reply;
+    sendCommand(sockfd, "ATTACH_JOB " + jobId);
+    if (!receiveCommand(sockfd, reply) || reply.rfind("JOB_ATTACHED", 0) != 0) {
+        cout << "[server] " << reply << "\n";
+        return 1;
+    }
+    cout << "[server] " << reply << "\n";
+    if (reply == "JOB_ATTACHED: running") {
+        while (receiveCommand(sockfd, reply) && reply != "TRANSPOSE_COMPLETED" && reply != "JOB_CANCELLED")
+            if (reply.rfind("PROGRESS:", 0) != 0) cout << "[server] " << reply << "\n";
+    }
+    sendCommand(sockfd, "REQUEST_RESULTS");
+    while (receiveCommand(sockfd, reply) && reply.rfind("RESULT:", 0) != 0 && reply.rfind("ERROR", 0) != 0) {}
+    cout << "\n===== RESULT =====\n" << reply << "\n";
+    sendCommand(sockfd, "QUIT");
+    close(sockfd);
+    return reply.rfind("RESULT:", 0) == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    bool forceTcp = false;
+    int port = PORT;
+    int streamRows = 0;
+    string attachId;
+    string encodingArg = "auto";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--tcp") forceTcp = true;
+        else if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+        else if (arg == "--encoding" && i + 1 < argc) encodingArg = argv[++i];
+        else if (arg == "--stream" && i + 1 < argc) streamRows = atoi(argv[++i]);
+        else if (arg == "--attach" && i + 1 < argc) attachId = argv[++i];
+    }
+    // The shared-memory socket belongs to the server on the default port.
+    int sockfd = forceTcp || port != PORT ? -1 : connectLocal();
+    bool local = sockfd >= 0;
+    if (!local) sockfd = connectTcp(port);
+    if (sockfd < 0) return 1;
+    cout << "[client] Connected" << (local ? " (local socket)" : "") << "\n";
     sendCommand(sockfd, "HELLO");
     string reply;
     if (receiveCommand(sockfd, reply))
         cout << "[server] " << reply << "\n";
+    if (!attachId.empty())
+        return runAttach(sockfd, attachId);
+
+    // Offer the encodings we are willing to use; the server answers with the
+    // ones it accepts.
+    vector<uint32_t> encodings;
+    if (!local && encodingArg != "raw") {
+        sendCommand(sockfd, encodingArg == "auto" ? "ENCODINGS for,delta,lz" : "ENCODINGS " + encodingArg);
+        if (receiveCommand(sockfd, reply) && reply.rfind("ENCODINGS", 0) == 0) {
+            stringstream ss(reply.size() > 10 ? reply.substr(10) : "");
+            string name;
+            uint32_t enc;
+            while (getline(ss, name, ','))
+                if (parseEncoding(name, enc) && enc != ENC_RAW) encodings.push_back(enc);
+        }
+    }
 
     int n;
     cout << "Enter matrix size n: ";
@@ -97,49 +256,133 @@ int main() {
     }
     if (cfg.empty()) cfg = {1, 2, 4, 8, 16};
 
-    vector<vector<int>> matrix(n, vector<int>(n));
-    for (auto& row : matrix)
-        for (int& v : row)
-            v = rand() % 100;
+    if (streamRows > 0)
+        return runStreaming(sockfd, n, cfg.front(), min(streamRows, n));
+
+    size_t matrixBytes = static_cast<size_t>(n) * n * sizeof(int32_t);
+    int shmFd = local ? createSharedSegment(matrixBytes) : -1;
+    int32_t* shared = nullptr;
+    if (shmFd >= 0) {
+        void* p = mmap(nullptr, matrixBytes, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+        if (p != MAP_FAILED) {
+            shared = static_cast<int32_t*>(p);
+        } else {
+            close(shmFd);
+            shmFd = -1;
+        }
+    }
 
-    sendCommand(sockfd, "UPLOAD_MATRIX");
     MatrixUploadInfo hdr{};
     hdr.matrix_size = htonl(n);
     hdr.num_configs = htonl(static_cast<uint32_t>(cfg.size()));
     hdr.matrix_bytes = htonl(n * n * static_cast<int>(sizeof(int)));
-    sendAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
 
     vector<int32_t> cfgNet(cfg.size());
     for (size_t i = 0; i < cfg.size(); ++i)
         cfgNet[i] = htonl(cfg[i]);
-    sendAll(sockfd, reinterpret_cast<char*>(cfgNet.data()), cfgNet.size() * sizeof(int32_t));
 
-    vector<int32_t> flat;
-    flat.reserve(n * n);
-    for (auto& row : matrix)
-        for (int v : row)
-            flat.push_back(htonl(v));
-    sendAll(sockfd, reinterpret_cast<char*>(flat.data()), flat.size() * sizeof(int32_t));
+    bool uploadAcked = false;
+    if (shared) {
+        // Same host: the matrix is written straight into the segment and only
+        // its descriptor crosses the socket.
+        for (size_t i = 0; i < static_cast<size_t>(n) * n; ++i)
+            shared[i] = rand() % 100;
+        sendCommand(sockfd, "UPLOAD_MATRIX_SHM");
+        sendAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+        sendAll(sockfd, reinterpret_cast<char*>(cfgNet.data()), cfgNet.size() * sizeof(int32_t));
+        sendFd(sockfd, shmFd);
+        close(shmFd);
+    } else {
+        vector<vector<int>> matrix(n, vector<int>(n));
+        for (auto& row : matrix)
+            for (int& v : row)
+                v = rand() % 100;
 
-    if (receiveCommand(sockfd, reply))
+        vector<int32_t> flat;
+        flat.reserve(n * n);
+        for (auto& row : matrix)
+            for (int v : row)
+                flat.push_back(htonl(v));
+
+        // The server may still hold this matrix from an earlier run; then
+        // only its hash has to cross the wire.
+        uint64_t hash = matrixHash(reinterpret_cast<char*>(flat.data()), flat.size() * sizeof(int32_t));
+        sendCommand(sockfd, "UPLOAD_BY_HASH");
+        sendAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+        sendAll(sockfd, reinterpret_cast<char*>(cfgNet.data()), cfgNet.size() * sizeof(int32_t));
+        sendHash(sockfd, hash);
+        if (receiveCommand(sockfd, reply) && reply == "HASH_UNKNOWN" && !encodings.empty()) {
+            size_t payloadBytes = flat.size() * sizeof(int32_t);
+            vector<uint32_t> chunkEnc;
+            vector<vector<char>> chunks =
+                encodePayload(reinterpret_cast<char*>(flat.data()), payloadBytes, encodings, chunkEnc);
+            size_t wireBytes = 0;
+            sendCommand(sockfd, "UPLOAD_MATRIX_ENC");
+            sendAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+            sendAll(sockfd, reinterpret_cast<char*>(cfgNet.data()), cfgNet.size() * sizeof(int32_t));
+            for (size_t k = 0; k < chunks.size(); ++k) {
+                EncodedChunkHeader ch{};
+                ch.raw_bytes = htonl(static_cast<uint32_t>(min(HASH_CHUNK, payloadBytes - k * HASH_CHUNK)));
+                ch.enc_bytes = htonl(static_cast<uint32_t>(chunks[k].size()));
+                ch.encoding = htonl(chunkEnc[k]);
+                sendAll(sockfd, reinterpret_cast<char*>(&ch), sizeof(ch));
+                sendAll(sockfd, chunks[k].data(), static_cast<int>(chunks[k].size()));
+                wireBytes += sizeof(ch) + chunks[k].size();
+            }
+            cout << "[client] encoded upload: " << payloadBytes << " -> " << wireBytes << " bytes\n";
+        } else if (reply == "HASH_UNKNOWN") {
+            sendCommand(sockfd, "UPLOAD_MATRIX");
+            sendAll(sockfd, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+            sendAll(sockfd, reinterpret_cast<char*>(cfgNet.data()), cfgNet.size() * sizeof(int32_t));
+            sendAll(sockfd, reinterpret_cast<char*>(flat.data()), flat.size() * sizeof(int32_t));
+        } else {
+            cout << "[client] matrix already cached on the server\n";
+            uploadAcked = true;
+        }
+    }
+
+    if (uploadAcked || receiveCommand(sockfd, reply))
         cout << "[server] " << reply << "\n";
 
     sendCommand(sockfd, "START_TRANSPOSE");
 
     atomic<bool> done{false};
     atomic<bool> resultReady{false};
+    atomic<bool> failed{false};
     string finalResult;
 
+    // Progress is pushed by the server; it is redrawn in place on one line.
+    // An ERROR ends the session only as the answer to START_TRANSPOSE or to
+    // REQUEST_RESULTS; otherwise it just answers one of the commands typed
+    // meanwhile (a second "c" gets ERROR: CANCELLING, for instance).
     thread listener([&] {
         string msg;
+        bool progressShown = false;
+        bool started = false;
         while (receiveCommand(sockfd, msg)) {
+            if (msg.rfind("PROGRESS:", 0) == 0) {
+                cout << "\r[server] " << msg << "    " << flush;
+                progressShown = true;
+                continue;
+            }
+            if (progressShown) {
+                cout << "\n";
+                progressShown = false;
+            }
             if (msg.rfind("INFO:", 0) == 0) {
                 cout << "[server] " << msg << "\n";
-            } else if (msg == "TRANSPOSE_STARTED") {
+            } else if (msg.rfind("TRANSPOSE_STARTED", 0) == 0 || msg.rfind("TRANSPOSE_QUEUED", 0) == 0) {
                 cout << "[server] " << msg << "\n";
-            } else if (msg == "TRANSPOSE_COMPLETED") {
+                started = true;
+            } else if (msg == "TRANSPOSE_COMPLETED" || msg == "JOB_CANCELLED") {
                 cout << "[server] " << msg << "\n";
                 done = true;
+            } else if (msg.rfind("ERROR", 0) == 0) {
+                cout << "[server] " << msg << "\n";
+                if (started && msg != "ERROR: NO RESULTS") continue;
+                failed = true;
+                done = true;
+                break;
             } else if (msg.rfind("RESULT:", 0) == 0) {
                 finalResult = msg;
                 resultReady = true;
@@ -148,25 +391,43 @@ int main() {
                 cout << "[server] " << msg << "\n";
             }
         }
+        if (!resultReady) {
+            failed = true;
+            done = true;
+        }
     });
 
-    cout << "\nPress Enter to request STATUS, until finished\n";
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cout << "\nEnter = STATUS, c + Enter = cancel\n";
+    bool stdinOpen = true;
     while (!done) {
-        cin.get();
-        sendCommand(sockfd, "REQUEST_STATUS");
+        pollfd pfd{STDIN_FILENO, POLLIN, 0};
+        if (!stdinOpen || poll(&pfd, 1, 100) <= 0) {
+            if (!stdinOpen) this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+        string input;
+        if (!getline(cin, input)) {
+            stdinOpen = false;
+            continue;
+        }
+        sendCommand(sockfd, input == "c" ? "CANCEL_JOB" : "REQUEST_STATUS");
     }
 
-    sendCommand(sockfd, "REQUEST_RESULTS");
-    while (!resultReady)
-        this_thread::sleep_for(chrono::milliseconds(10));
+    if (!failed) {
+        sendCommand(sockfd, "REQUEST_RESULTS");
+        while (!resultReady && !failed)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    }
 
     listener.join();
 
-    cout << "\n===== RESULT =====\n";
-    cout << finalResult << "\n";
+    if (resultReady) {
+        cout << "\n===== RESULT =====\n";
+        cout << finalResult << "\n";
+    }
 
     sendCommand(sockfd, "QUIT");
     close(sockfd);
-    return 0;
+    if (shared) munmap(shared, matrixBytes);
+    return resultReady ? 0 : 1;
 }
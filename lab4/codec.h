@@ -0,0 +1,258 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Payload encodings for UPLOAD_MATRIX_ENC. The matrix is cut into HASH_CHUNK
+// byte chunks of the big-endian wire payload and every chunk is encoded on its
+// own, so the server can decode chunks in parallel while later ones arrive.
+// Decoders reproduce the exact wire bytes, which keeps content hashes stable.
+enum Encoding : uint32_t {
+    ENC_RAW = 0,
+    ENC_FOR = 1,    // frame of reference + bit packing
+    ENC_DELTA = 2,  // zigzag delta + varint
+    ENC_LZ = 3,     // LZ4-style byte compressor
+    ENC_COUNT
+};
+
+struct EncodedChunkHeader {
+    uint32_t raw_bytes;
+    uint32_t enc_bytes;
+    uint32_t encoding;
+};
+
+inline const char* encodingName(uint32_t enc) {
+    static const char* names[] = {"raw", "for", "delta", "lz"};
+    return enc < ENC_COUNT ? names[enc] : "?";
+}
+
+inline bool parseEncoding(const std::string& name, uint32_t& enc) {
+    for (uint32_t e = 0; e < ENC_COUNT; e++)
+        if (name == encodingName(e)) {
+            enc = e;
+            return true;
+        }
+    return false;
+}
+
+// Upper bound on an encoded chunk; lets the receiver reject garbage headers.
+inline size_t maxEncodedBytes(size_t rawBytes) {
+    return rawBytes + rawBytes / 255 + 64;
+}
+
+namespace codec {
+
+inline int32_t loadBE(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (int32_t)ntohl(v);
+}
+
+inline void storeBE(char* p, int32_t v) {
+    uint32_t n = htonl((uint32_t)v);
+    memcpy(p, &n, 4);
+}
+
+inline void putVarint(std::vector<char>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+inline std::vector<char> encodeFor(const char* raw, size_t count) {
+    int32_t lo = 0, hi = 0;
+    for (size_t i = 0; i < count; i++) {
+        int32_t v = loadBE(raw + 4 * i);
+        if (i == 0 || v < lo) lo = v;
+        if (i == 0 || v > hi) hi = v;
+    }
+    uint32_t range = (uint32_t)hi - (uint32_t)lo;
+    int bits = 0;
+    while (bits < 32 && (range >> bits) != 0) bits++;
+    std::vector<char> out(5 + (count * bits + 7) / 8);
+    storeBE(out.data(), lo);
+    out[4] = (char)bits;
+    unsigned char* dst = (unsigned char*)out.data() + 5;
+    uint64_t acc = 0;
+    int filled = 0;
+    for (size_t i = 0; i < count; i++) {
+        acc |= (uint64_t)((uint32_t)loadBE(raw + 4 * i) - (uint32_t)lo) << filled;
+        filled += bits;
+        while (filled >= 8) {
+            *dst++ = (unsigned char)acc;
+            acc >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) *dst = (unsigned char)acc;
+    return out;
+}
+
+inline bool decodeFor(const char* src, size_t srcBytes, char* raw, size_t count) {
+    if (srcBytes < 5) return false;
+    int32_t lo = loadBE(src);
+    int bits = (unsigned char)src[4];
+    if (bits > 32 || srcBytes != 5 + (count * bits + 7) / 8) return false;
+    const unsigned char* p = (const unsigned char*)src + 5;
+    uint64_t mask = bits == 32 ? 0xffffffffULL : (1ULL << bits) - 1;
+    uint64_t acc = 0;
+    int filled = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (filled < bits) {
+            acc |= (uint64_t)*p++ << filled;
+            filled += 8;
+        }
+        storeBE(raw + 4 * i, (int32_t)((uint32_t)lo + (uint32_t)(acc & mask)));
+        acc >>= bits;
+        filled -= bits;
+    }
+    return true;
+}
+
+inline std::vector<char> encodeDelta(const char* raw, size_t count) {
+    std::vector<char> out;
+    out.reserve(count * 2);
+    uint32_t prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t v = (uint32_t)loadBE(raw + 4 * i);
+        int32_t d = (int32_t)(v - prev);
+        putVarint(out, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+        prev = v;
+    }
+    return out;
+}
+
+inline bool decodeDelta(const char* src, size_t srcBytes, char* raw, size_t count) {
+    const unsigned char* p = (const unsigned char*)src;
+    const unsigned char* end = p + srcBytes;
+    uint32_t prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t z = 0;
+        for (int shift = 0;; shift += 7) {
+            if (p == end || shift > 28) return false;
+            unsigned char b = *p++;
+            z |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+        prev += (z >> 1) ^ (0u - (z & 1));
+        storeBE(raw + 4 * i, (int32_t)prev);
+    }
+    return p == end;
+}
+
+// Sequences are: token (literal length << 4 | match length - 4), extra length
+// bytes, literals, 16-bit little-endian offset, extra match length bytes.
+// The last sequence carries literals only.
+inline std::vector<char> encodeLz(const char* raw, size_t n) {
+    constexpr int HASH_BITS = 14;
+    constexpr size_t MIN_MATCH = 4;
+    const unsigned char* src = (const unsigned char*)raw;
+    std::vector<char> out;
+    out.reserve(n / 2 + 16);
+    std::vector<uint32_t> table(1 << HASH_BITS, 0);
+    auto read32 = [&](size_t i) {
+        uint32_t v;
+        memcpy(&v, src + i, 4);
+        return v;
+    };
+    auto putLength = [&](size_t len) {
+        for (; len >= 255; len -= 255) out.push_back((char)255);
+        out.push_back((char)len);
+    };
+    auto putSequence = [&](size_t litStart, size_t litLen, size_t offset, size_t matchLen) {
+        size_t ml = matchLen ? matchLen - MIN_MATCH : 0;
+        out.push_back((char)((std::min<size_t>(litLen, 15) << 4) | std::min<size_t>(ml, 15)));
+        if (litLen >= 15) putLength(litLen - 15);
+        out.insert(out.end(), raw + litStart, raw + litStart + litLen);
+        if (!matchLen) return;
+        out.push_back((char)(offset & 0xff));
+        out.push_back((char)(offset >> 8));
+        if (ml >= 15) putLength(ml - 15);
+    };
+    size_t anchor = 0, i = 0;
+    while (i + MIN_MATCH <= n) {
+        uint32_t seq = read32(i);
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        size_t cand = table[h];
+        table[h] = (uint32_t)(i + 1);
+        if (cand && i - (cand - 1) <= 0xffff && read32(cand - 1) == seq) {
+            size_t m = cand - 1;
+            size_t len = MIN_MATCH;
+            while (i + len < n && src[m + len] == src[i + len]) len++;
+            putSequence(anchor, i - anchor, i - m, len);
+            i += len;
+            anchor = i;
+        } else {
+            i++;
+        }
+    }
+    putSequence(anchor, n - anchor, 0, 0);
+    return out;
+}
+
+inline bool decodeLz(const char* srcData, size_t srcBytes, char* raw, size_t n) {
+    const unsigned char* p = (const unsigned char*)srcData;
+    const unsigned char* end = p + srcBytes;
+    size_t o = 0;
+    auto getLength = [&](size_t& len) {
+        unsigned char b;
+        do {
+            if (p == end) return false;
+            b = *p++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (p < end) {
+        unsigned char token = *p++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !getLength(lit)) return false;
+        if ((size_t)(end - p) < lit || n - o < lit) return false;
+        memcpy(raw + o, p, lit);
+        p += lit;
+        o += lit;
+        if (p == end) break;
+        if (end - p < 2) return false;
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t ml = token & 15;
+        if (ml == 15 && !getLength(ml)) return false;
+        ml += 4;
+        if (offset == 0 || offset > o || n - o < ml) return false;
+        for (size_t k = 0; k < ml; k++, o++)
+            raw[o] = raw[o - offset];
+    }
+    return o == n;
+}
+
+}
+
+// `raw` is one chunk of the big-endian wire payload (a multiple of 4 bytes).
+inline std::vector<char> encodeChunk(uint32_t enc, const char* raw, size_t rawBytes) {
+    switch (enc) {
+    case ENC_FOR: return codec::encodeFor(raw, rawBytes / 4);
+    case ENC_DELTA: return codec::encodeDelta(raw, rawBytes / 4);
+    case ENC_LZ: return codec::encodeLz(raw, rawBytes);
+    default: return std::vector<char>(raw, raw + rawBytes);
+    }
+}
+
+inline bool decodeChunk(uint32_t enc, const char* src, size_t srcBytes, char* raw, size_t rawBytes) {
+    switch (enc) {
+    case ENC_RAW:
+        if (srcBytes != rawBytes) return false;
+        memcpy(raw, src, rawBytes);
+        return true;
+    case ENC_FOR: return codec::decodeFor(src, srcBytes, raw, rawBytes / 4);
+    case ENC_DELTA: return codec::decodeDelta(src, srcBytes, raw, rawBytes / 4);
+    case ENC_LZ: return codec::decodeLz(src, srcBytes, raw, rawBytes);
+    default: return false;
+    }
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+constexpr int PORT = 12345;
+constexpr char SHM_SOCKET_PATH[] = "/tmp/lab4_transpose.sock";
+
+struct CommandPacket {
+    uint32_t length;
+    char command[256];
+};
+
+struct MatrixUploadInfo {
+    uint32_t matrix_size;
+    uint32_t num_configs;
+    uint32_t matrix_bytes;
+};
+
+// STREAM_TRANSPOSE: the matrix follows as block_rows-row blocks of raw
+// big-endian int32, and the transpose comes back as RESULT_BLOCK packets,
+// each followed by a StreamBlockHeader and its rows.
+struct StreamInfo {
+    uint32_t matrix_size;
+    uint32_t threads;
+    uint32_t block_rows;
+};
+
+struct StreamBlockHeader {
+    uint32_t row_start;
+    uint32_t rows;
+};
+
+// TRANSPOSE_BLOCK (coordinator -> worker): a rows x cols tile of int32 follows;
+// the worker answers BLOCK_TRANSPOSED and the cols x rows transpose. Values
+// are moved as opaque words, so byte order is whatever the sender used.
+struct BlockInfo {
+    uint32_t rows;
+    uint32_t cols;
+};
+
+inline int recvAll(int s, char* buffer, int length) {
+    int received = 0;
+    while (received < length) {
+        int n = recv(s, buffer + received, length - received, 0);
+        if (n <= 0) return -1;
+        received += n;
+    }
+    return received;
+}
+
+inline int sendAll(int s, const char* data, int length) {
+    int sent = 0;
+    while (sent < length) {
+        int n = send(s, data + sent, length - sent, 0);
+        if (n <= 0) return -1;
+        sent += n;
+    }
+    return sent;
+}
+
+inline bool sendCommand(int s, const std::string& cmd) {
+    if (cmd.size() > 256) return false;
+    CommandPacket pkt{};
+    pkt.length = htonl((uint32_t)cmd.size());
+    memcpy(pkt.command, cmd.data(), cmd.size());
+    return sendAll(s, (char*)&pkt, sizeof(pkt)) == sizeof(pkt);
+}
+
+inline bool receiveCommand(int s, std::string& outCmd) {
+    CommandPacket pkt{};
+    if (recvAll(s, (char*)&pkt, sizeof(pkt)) != sizeof(pkt)) return false;
+    uint32_t len = ntohl(pkt.length);
+    if (len > 256) return false;
+    outCmd.assign(pkt.command, pkt.command + len);
+    return true;
+}
+
+inline bool sendHash(int s, uint64_t h) {
+    uint32_t net[2] = {htonl((uint32_t)(h >> 32)), htonl((uint32_t)h)};
+    return sendAll(s, (char*)net, sizeof(net)) == sizeof(net);
+}
+
+inline bool receiveHash(int s, uint64_t& h) {
+    uint32_t net[2];
+    if (recvAll(s, (char*)net, sizeof(net)) != sizeof(net)) return false;
+    h = ((uint64_t)ntohl(net[0]) << 32) | ntohl(net[1]);
+    return true;
+}
+
+// XXH64 (little-endian hosts). Matrices are hashed as a two-level tree:
+// every HASH_CHUNK bytes of the big-endian wire payload is hashed on its own,
+// then the chunk hashes are hashed with the payload length as seed. Chunks
+// can therefore be hashed in parallel and while the upload is still arriving.
+constexpr size_t HASH_CHUNK = 1 << 20;
+
+namespace xxh {
+constexpr uint64_t P1 = 11400714785074694791ULL;
+constexpr uint64_t P2 = 14029467366897019727ULL;
+constexpr uint64_t P3 = 1609587929392839161ULL;
+constexpr uint64_t P4 = 9650029242287828579ULL;
+constexpr uint64_t P5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+}
+}
+
+inline uint64_t xxhash64(const void* data, size_t len, uint64_t seed) {
+    using namespace xxh;
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        do {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * P5;
+        h = rotl(h, 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t combineChunkHashes(const std::vector<uint64_t>& chunks, size_t len) {
+    return xxhash64(chunks.data(), chunks.size() * sizeof(uint64_t), len);
+}
+
+inline uint64_t matrixHash(const char* data, size_t len) {
+    std::vector<uint64_t> chunks;
+    for (size_t off = 0; off < len; off += HASH_CHUNK)
+        chunks.push_back(xxhash64(data + off, std::min(HASH_CHUNK, len - off), 0));
+    return combineChunkHashes(chunks, len);
+}
@@ -1,232 +1,1545 @@
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
 
 #include <iostream>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <unordered_map>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <chrono>
 #include <string>
 #include <cstring>
+#include <list>
+#include <sstream>
+#include <algorithm>
+
+#include "protocol.h"
+#include "codec.h"
 
 using namespace std;
 using namespace chrono;
 
-struct CommandPacket {
-    uint32_t length;
-    char command[256];
-};
+// Matrix that lives in a client-created memfd/shm segment. The server transposes
+// it in place, so the client sees the result without any payload copy.
+struct SharedSegment {
+    int32_t* data = nullptr;
+    size_t bytes = 0;
 
-struct MatrixUploadInfo {
-    uint32_t matrix_size;
-    uint32_t num_configs;
-    uint32_t matrix_bytes;
+    ~SharedSegment() {
+        if (data) munmap(data, bytes);
+    }
 };
 
-struct ClientTask {
-    vector<vector<int>> baseMatrix;
+// Immutable snapshot of one upload. Jobs keep it alive on their own, so a
+// re-upload or a disconnect never pulls the matrix from under a running step.
+struct MatrixUpload {
+    int n = 0;
+    shared_ptr<const vector<int32_t>> baseMatrix;
+    uint64_t hash = 0;
+    shared_ptr<SharedSegment> shm;
     vector<int> threadConfigs;
-    vector<double> times;
-    size_t currentIndex = 0;
-    bool isProcessing = false;
 };
 
-unordered_map<int, ClientTask> g_clients;
+// Name of the kernel in result-cache keys; change it whenever the kernel changes.
+constexpr char KERNEL_NAME[] = "tiled64";
+
+// Content-addressed store of uploaded matrices (host byte order), keyed by
+// matrixHash() of their wire payload, together with the timings measured on
+// them per (kernel, threads). Bounded by a byte budget with LRU eviction;
+// evicted matrices stay alive for as long as a job still uses them.
+class MatrixCache {
+public:
+    void configure(size_t budgetBytes) {
+        lock_guard<mutex> lock(m_mutex);
+        m_budget = budgetBytes;
+        evict();
+    }
+
+    shared_ptr<const vector<int32_t>> find(uint64_t hash, int n) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end() || it->second.n != n) return nullptr;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second.matrix;
+    }
+
+    // Returns the cached copy if an equal matrix is already stored.
+    shared_ptr<const vector<int32_t>> insert(uint64_t hash, int n, shared_ptr<const vector<int32_t>> matrix) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it != m_entries.end() && it->second.n == n) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            return it->second.matrix;
+        }
+        size_t bytes = matrix->size() * sizeof(int32_t);
+        if (bytes > m_budget) return matrix;
+        if (it != m_entries.end()) erase(it);
+        m_lru.push_front(hash);
+        m_entries[hash] = Entry{n, matrix, m_lru.begin(), {}};
+        m_bytes += bytes;
+        evict();
+        return matrix;
+    }
+
+    bool findTiming(uint64_t hash, const string& kernel, int threads, double& sec) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end()) return false;
+        auto t = it->second.timings.find(kernel + "/" + to_string(threads));
+        if (t == it->second.timings.end()) return false;
+        sec = t->second;
+        return true;
+    }
+
+    void storeTiming(uint64_t hash, const string& kernel, int threads, double sec) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it != m_entries.end())
+            it->second.timings[kernel + "/" + to_string(threads)] = sec;
+    }
+
+private:
+    struct Entry {
+        int n;
+        shared_ptr<const vector<int32_t>> matrix;
+        list<uint64_t>::iterator lru;
+        unordered_map<string, double> timings;
+    };
+
+    void erase(unordered_map<uint64_t, Entry>::iterator it) {
+        m_bytes -= it->second.matrix->size() * sizeof(int32_t);
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
 
-int recvAll(int s, char* buffer, int length) {
-    int received = 0;
-    while (received < length) {
-        int n = recv(s, buffer + received, length - received, 0);
-        if (n <= 0) return -1;
-        received += n;
+    void evict() {
+        while (m_bytes > m_budget && !m_lru.empty())
+            erase(m_entries.find(m_lru.back()));
     }
-    return received;
+
+    mutex m_mutex;
+    unordered_map<uint64_t, Entry> m_entries;
+    list<uint64_t> m_lru;
+    size_t m_bytes = 0;
+    size_t m_budget = 0;
+};
+
+MatrixCache g_cache;
+
+// Receives one byte carrying an SCM_RIGHTS descriptor. Returns -1 if the
+// peer did not attach one (e.g. the command arrived over TCP).
+int recvFd(int s) {
+    char byte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    if (recvmsg(s, &msg, 0) <= 0) return -1;
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(c), sizeof(fd));
+    return fd;
 }
 
-int sendAll(int s, const char* data, int length) {
-    int sent = 0;
-    while (sent < length) {
-        int n = send(s, data + sent, length - sent, 0);
-        if (n <= 0) return -1;
-        sent += n;
+// The size check alone proves nothing about a client's fd: the client can
+// still shrink it afterwards, and the next touch of the mapping kills the
+// whole server with SIGBUS. Client segments must therefore be sealed against
+// resizing (POSIX shm without seals can't be resized once sized).
+bool sealedAgainstResize(int fd) {
+#ifdef F_GET_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & F_SEAL_SHRINK) && (seals & F_SEAL_GROW);
+#else
+    (void)fd;
+    return true;
+#endif
+}
+
+shared_ptr<SharedSegment> mapSegment(int fd, size_t bytes, bool requireSeals) {
+    if (requireSeals && !sealedAgainstResize(fd)) return nullptr;
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < bytes) return nullptr;
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return nullptr;
+    auto seg = make_shared<SharedSegment>();
+    seg->data = (int32_t*)p;
+    seg->bytes = bytes;
+    return seg;
+}
+
+// Hashes one chunk of wire payload and converts it to host order in place.
+uint64_t finishChunk(char* p, size_t len) {
+    uint64_t h = xxhash64(p, len, 0);
+    int32_t* v = (int32_t*)p;
+    for (size_t k = 0; k < len / 4; k++)
+        v[k] = ntohl(v[k]);
+    return h;
+}
+
+// Receives the big-endian payload into `out`. A helper thread hashes each
+// completed HASH_CHUNK and converts it to host order while the next chunk is
+// still arriving, so hashing costs no extra pass after the upload.
+bool receiveMatrix(int cs, vector<int32_t>& out, size_t bytes, uint64_t& hash) {
+    char* buf = (char*)out.data();
+    size_t chunks = (bytes + HASH_CHUNK - 1) / HASH_CHUNK;
+    vector<uint64_t> chunkHashes(chunks);
+    mutex m;
+    condition_variable cv;
+    size_t received = 0;
+    bool failed = false;
+    thread hasher([&] {
+        size_t next = 0;
+        while (next < chunks) {
+            size_t avail;
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&] { return failed || received >= min(bytes, (next + 1) * HASH_CHUNK); });
+                if (failed) return;
+                avail = received;
+            }
+            for (; next < chunks && min(bytes, (next + 1) * HASH_CHUNK) <= avail; next++) {
+                size_t off = next * HASH_CHUNK;
+                chunkHashes[next] = finishChunk(buf + off, min(HASH_CHUNK, bytes - off));
+            }
+        }
+    });
+    size_t got = 0;
+    bool ok = true;
+    while (got < bytes) {
+        ssize_t r = recv(cs, buf + got, min(bytes - got, HASH_CHUNK), 0);
+        if (r <= 0) {
+            ok = false;
+            break;
+        }
+        size_t before = got;
+        got += r;
+        if (got / HASH_CHUNK != before / HASH_CHUNK || got == bytes) {
+            lock_guard<mutex> lock(m);
+            received = got;
+            cv.notify_one();
+        }
     }
-    return sent;
+    if (!ok) {
+        lock_guard<mutex> lock(m);
+        failed = true;
+        cv.notify_one();
+    }
+    hasher.join();
+    if (!ok) return false;
+    hash = combineChunkHashes(chunkHashes, bytes);
+    return true;
 }
 
-bool sendCommand(int s, const string& cmd) {
-    if (cmd.size() > 256) return false;
-    CommandPacket pkt{};
-    pkt.length = htonl((uint32_t)cmd.size());
-    memcpy(pkt.command, cmd.data(), cmd.size());
-    return sendAll(s, (char*)&pkt, sizeof(pkt)) == sizeof(pkt);
+// Receives an UPLOAD_MATRIX_ENC payload: one EncodedChunkHeader plus data per
+// HASH_CHUNK of the wire payload. The socket thread only reads; a small pool
+// decodes, hashes and byte-swaps chunks straight into `out` in parallel.
+bool receiveEncodedMatrix(int cs, vector<int32_t>& out, size_t bytes, uint32_t allowed, uint64_t& hash) {
+    struct Task {
+        size_t index;
+        uint32_t encoding;
+        vector<char> data;
+    };
+    char* buf = (char*)out.data();
+    size_t chunks = (bytes + HASH_CHUNK - 1) / HASH_CHUNK;
+    vector<uint64_t> chunkHashes(chunks);
+    int workers = (int)clamp<size_t>(thread::hardware_concurrency(), 1, 4);
+    mutex m;
+    condition_variable cv;
+    deque<Task> tasks;
+    bool closed = false;
+    atomic<bool> bad{false};
+
+    vector<thread> decoders;
+    for (int w = 0; w < workers; w++) {
+        decoders.emplace_back([&] {
+            while (true) {
+                Task task;
+                {
+                    unique_lock<mutex> lock(m);
+                    cv.wait(lock, [&] { return closed || !tasks.empty(); });
+                    if (tasks.empty()) return;
+                    task = move(tasks.front());
+                    tasks.pop_front();
+                }
+                cv.notify_all();
+                size_t off = task.index * HASH_CHUNK;
+                size_t len = min(HASH_CHUNK, bytes - off);
+                if (!decodeChunk(task.encoding, task.data.data(), task.data.size(), buf + off, len))
+                    bad = true;
+                else
+                    chunkHashes[task.index] = finishChunk(buf + off, len);
+            }
+        });
+    }
+
+    bool ok = true;
+    for (size_t k = 0; k < chunks && ok && !bad; k++) {
+        EncodedChunkHeader hdr{};
+        ok = recvAll(cs, (char*)&hdr, sizeof(hdr)) == sizeof(hdr);
+        if (!ok) break;
+        size_t rawBytes = ntohl(hdr.raw_bytes);
+        size_t encBytes = ntohl(hdr.enc_bytes);
+        uint32_t encoding = ntohl(hdr.encoding);
+        ok = rawBytes == min(HASH_CHUNK, bytes - k * HASH_CHUNK) && encoding < ENC_COUNT &&
+             (allowed & (1u << encoding)) && encBytes <= maxEncodedBytes(rawBytes);
+        if (!ok) break;
+        Task task{k, encoding, vector<char>(encBytes)};
+        ok = recvAll(cs, task.data.data(), (int)encBytes) == (int)encBytes;
+        if (!ok) break;
+        unique_lock<mutex> lock(m);
+        cv.wait(lock, [&] { return tasks.size() < (size_t)workers * 2; });
+        tasks.push_back(move(task));
+        cv.notify_all();
+    }
+    {
+        lock_guard<mutex> lock(m);
+        closed = true;
+    }
+    cv.notify_all();
+    for (auto& d : decoders) d.join();
+    if (!ok || bad) return false;
+    hash = combineChunkHashes(chunkHashes, bytes);
+    return true;
 }
 
-bool receiveCommand(int s, string& outCmd) {
-    CommandPacket pkt{};
-    if (recvAll(s, (char*)&pkt, sizeof(pkt)) != sizeof(pkt)) return false;
-    uint32_t len = ntohl(pkt.length);
-    if (len > 256) return false;
-    outCmd.assign(pkt.command, pkt.command + len);
+// No real sweep has more thread configurations than this.
+constexpr int MAX_THREAD_CONFIGS = 64;
+
+// Validates the header before anything is sized from it: the payload length
+// has to match n*n int32s exactly, computed wide so no n can wrap it.
+bool receiveUploadHeader(int cs, MatrixUpload& up, size_t& bytes) {
+    MatrixUploadInfo info{};
+    if (recvAll(cs, (char*)&info, sizeof(info)) != sizeof(info))
+        return false;
+    int n = (int)ntohl(info.matrix_size);
+    int cfgCount = (int)ntohl(info.num_configs);
+    bytes = ntohl(info.matrix_bytes);
+    if (n <= 0 || cfgCount < 0 || cfgCount > MAX_THREAD_CONFIGS ||
+        (uint64_t)bytes != (uint64_t)n * (uint64_t)n * 4)
+        return false;
+    vector<int32_t> cfgNet(cfgCount);
+    if (recvAll(cs, (char*)cfgNet.data(), cfgCount * 4) != cfgCount * 4)
+        return false;
+    up.n = n;
+    up.threadConfigs.resize(cfgCount);
+    for (int i = 0; i < cfgCount; i++) {
+        up.threadConfigs[i] = ntohl(cfgNet[i]);
+        if (up.threadConfigs[i] <= 0) up.threadConfigs[i] = 1;
+    }
     return true;
 }
 
-void transpose_part(vector<vector<int>>& a, int n, int start_i, int end_i) {
-    for (int i = start_i; i < end_i; i++)
-        for (int j = i + 1; j < n; j++)
-            swap(a[i][j], a[j][i]);
+constexpr int TILE = 64;
+
+// Shared by the kernels of one step and whoever reports on or cancels it.
+struct TransposeControl {
+    atomic<bool> cancelled{false};
+    atomic<size_t> tilesDone{0};
+    atomic<size_t> tilesTotal{0};
+};
+
+size_t tilesInPart(int n, int start_i, int end_i) {
+    size_t tiles = 0;
+    for (int i0 = start_i; i0 < end_i; i0 += TILE)
+        tiles += (n - i0 + TILE - 1) / TILE;
+    return tiles;
 }
 
-void transpose_multi(vector<vector<int>>& a, int threads_num) {
-    int n = (int)a.size();
-    if (n == 0) return;
-    if (threads_num <= 1) {
-        transpose_part(a, n, 0, n);
-        return;
+// Swaps rows [start_i, end_i) of the upper triangle with the lower one, one
+// TILE x TILE block at a time. The cancel flag is checked before every tile.
+bool transpose_part(int32_t* a, int n, int start_i, int end_i, TransposeControl* ctl) {
+    for (int i0 = start_i; i0 < end_i; i0 += TILE) {
+        int i1 = min(i0 + TILE, end_i);
+        size_t tiles = 0;
+        for (int j0 = i0; j0 < n; j0 += TILE) {
+            if (ctl && ctl->cancelled.load(memory_order_relaxed)) return false;
+            int j1 = min(j0 + TILE, n);
+            for (int i = i0; i < i1; i++)
+                for (int j = max(j0, i + 1); j < j1; j++)
+                    swap(a[(size_t)i * n + j], a[(size_t)j * n + i]);
+            tiles++;
+        }
+        if (ctl) ctl->tilesDone.fetch_add(tiles, memory_order_relaxed);
     }
-    vector<thread> threads;
-    threads.reserve(threads_num);
+    return true;
+}
+
+// Splits the rows into threads_num partitions exactly as before, but runs them
+// on at most `workers` threads so a job never exceeds the cores it was granted.
+// While the workers run, `tick` (if any) is called every `interval`.
+void transpose_multi(int32_t* a, int n, int threads_num, int workers,
+                     TransposeControl* ctl = nullptr,
+                     const function<void()>& tick = nullptr,
+                     milliseconds interval = milliseconds(100)) {
+    if (n == 0) return;
+    threads_num = max(1, threads_num);
+    vector<pair<int, int>> parts;
+    parts.reserve(threads_num);
     int base = n / threads_num;
     int extra = n % threads_num;
     int current = 0;
+    size_t totalTiles = 0;
     for (int t = 0; t < threads_num; t++) {
         int count = base + (t < extra);
         int start_i = current;
         int end_i = current + count;
         current = end_i;
         if (start_i >= end_i) break;
-        threads.emplace_back(transpose_part, ref(a), n, start_i, end_i);
+        parts.emplace_back(start_i, end_i);
+        totalTiles += tilesInPart(n, start_i, end_i);
+    }
+    if (ctl) ctl->tilesTotal.store(totalTiles, memory_order_relaxed);
+    workers = max(1, min(workers, (int)parts.size()));
+    if (workers == 1 && !tick) {
+        for (auto& p : parts)
+            if (!transpose_part(a, n, p.first, p.second, ctl)) break;
+        return;
+    }
+
+    mutex m;
+    condition_variable cv;
+    int running = workers;
+    vector<thread> threads;
+    threads.reserve(workers);
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back([&, w] {
+            for (size_t p = w; p < parts.size(); p += workers)
+                if (!transpose_part(a, n, parts[p].first, parts[p].second, ctl)) break;
+            lock_guard<mutex> lock(m);
+            if (--running == 0) cv.notify_one();
+        });
+    }
+    if (tick) {
+        unique_lock<mutex> lock(m);
+        while (!cv.wait_for(lock, interval, [&] { return running == 0; })) {
+            lock.unlock();
+            tick();
+            lock.lock();
+        }
     }
     for (auto& th : threads) th.join();
 }
 
-void processingThreadFunc(int cs) {
-    ClientTask& ct = g_clients[cs];
-    int n = (int)ct.baseMatrix.size();
-    if (n == 0 || ct.threadConfigs.empty()) {
-        sendCommand(cs, "ERROR: NO DATA");
-        ct.isProcessing = false;
-        return;
+// A step asked for `requested` threads but ran on only `effective` of them
+// (the cores it was granted); timings say so rather than pass for the former.
+string effectiveNote(int requested, int effective) {
+    return effective == requested ? "" : " (effective " + to_string(effective) + ")";
+}
+
+uint64_t nextJobId() {
+    static atomic<uint64_t> next{1};
+    return next.fetch_add(1, memory_order_relaxed);
+}
+
+// Progress fields are written only by the step that owns them and published
+// through atomics, so status polls read them without taking any lock.
+struct Job {
+    const uint64_t id = nextJobId();
+    // Session that receives the pushes; 0 while the job is parked.
+    atomic<uint64_t> sessionId{0};
+    shared_ptr<const MatrixUpload> upload;
+    vector<double> times;
+    vector<int> effectiveThreads;  // OS threads each config actually ran on
+    TransposeControl control;
+    atomic<size_t> currentIndex{0};
+    atomic<size_t> completed{0};
+    atomic<bool> finished{false};
+    atomic<bool> delivered{false};  // the full RESULT report has been sent
+
+    // Guarded by the scheduler mutex.
+    size_t next = 0;
+    bool running = false;
+    bool dropped = false;
+
+    int n() const { return upload->n; }
+    const vector<int>& configs() const { return upload->threadConfigs; }
+};
+
+struct Session {
+    const uint64_t id;
+    const int socket;
+    const bool local;
+
+    // Touched only by the connection's own serveClient thread.
+    shared_ptr<const MatrixUpload> upload;
+    shared_ptr<Job> job;
+    uint32_t encodings = 1u << ENC_RAW;
+
+    Session(uint64_t id, int socket, bool local) : id(id), socket(socket), local(local) {}
+
+    // The descriptor is closed only when the last reference goes away, so a
+    // step still reporting to this session can never write into a reused fd.
+    ~Session() { close(socket); }
+
+    bool send(const string& cmd) {
+        lock_guard<mutex> lock(m_sendMutex);
+        return sendCommand(socket, cmd);
+    }
+
+    // For a reply that must reach the client before anything a job pushes:
+    // hold the lock across whatever makes the job runnable, then sendLocked().
+    unique_lock<mutex> lockSend() { return unique_lock<mutex>(m_sendMutex); }
+    bool sendLocked(const string& cmd) { return sendCommand(socket, cmd); }
+
+    bool processing() const { return job && !job->finished.load(); }
+
+private:
+    mutex m_sendMutex;
+};
+
+// Live sessions keyed by a monotonically increasing id rather than the socket
+// fd. Sharding keeps connect/disconnect and lookups from serialising.
+class SessionRegistry {
+public:
+    shared_ptr<Session> create(int socket, bool local) {
+        uint64_t id = m_nextId.fetch_add(1, memory_order_relaxed);
+        auto session = make_shared<Session>(id, socket, local);
+        Shard& sh = shard(id);
+        lock_guard<mutex> lock(sh.m);
+        sh.sessions.emplace(id, session);
+        m_size.fetch_add(1, memory_order_relaxed);
+        return session;
+    }
+
+    shared_ptr<Session> find(uint64_t id) {
+        Shard& sh = shard(id);
+        lock_guard<mutex> lock(sh.m);
+        auto it = sh.sessions.find(id);
+        return it == sh.sessions.end() ? nullptr : it->second;
+    }
+
+    void remove(uint64_t id) {
+        Shard& sh = shard(id);
+        lock_guard<mutex> lock(sh.m);
+        if (sh.sessions.erase(id))
+            m_size.fetch_sub(1, memory_order_relaxed);
+    }
+
+    size_t size() const { return m_size.load(memory_order_relaxed); }
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Shard {
+        mutex m;
+        unordered_map<uint64_t, shared_ptr<Session>> sessions;
+    };
+
+    Shard& shard(uint64_t id) { return m_shards[id % SHARDS]; }
+
+    array<Shard, SHARDS> m_shards;
+    atomic<uint64_t> m_nextId{1};
+    atomic<size_t> m_size{0};
+};
+
+SessionRegistry g_sessions;
+
+struct JobStatus {
+    bool running = false;
+    size_t position = 0;
+    double eta = -1;
+};
+
+// Global transpose queue. Every job is executed one thread config ("step") at a
+// time; after a step the job goes to the back of the queue, so connections share
+// the core budget round-robin instead of each spawning its own threads.
+class JobScheduler {
+public:
+    enum class Admission { Started, Queued, Busy };
+
+    void configure(int cores, size_t maxQueued, milliseconds progressInterval) {
+        m_budget = max(1, cores);
+        m_freeCores = m_budget;
+        m_maxQueued = maxQueued;
+        m_progressInterval = progressInterval;
+    }
+
+    int budget() const { return m_budget; }
+
+    // Takes cores directly, bypassing the queue; used by streaming transposes,
+    // which must keep computing while their upload is still arriving.
+    int acquireCores(int threads) {
+        int want = coresFor(max(1, threads));
+        unique_lock<mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return m_freeCores >= want; });
+        m_freeCores -= want;
+        return want;
+    }
+
+    void releaseCores(int cores) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_freeCores += cores;
+        }
+        m_cv.notify_all();
+    }
+
+    void start() {
+        thread(&JobScheduler::dispatchLoop, this).detach();
+    }
+
+    Admission submit(const shared_ptr<Job>& job, size_t& position) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (m_queue.size() >= m_maxQueued)
+                return Admission::Busy;
+            bool immediate = m_queue.empty() && m_freeCores >= coresFor(*job);
+            m_queue.push_back(job);
+            position = m_queue.size();
+            if (!immediate) {
+                m_cv.notify_all();
+                return Admission::Queued;
+            }
+        }
+        m_cv.notify_all();
+        position = 0;
+        return Admission::Started;
+    }
+
+    // Cancels a job that has not finished yet. A queued job is finished at
+    // once. A running step sees the cancel flag at its next tile, and the job
+    // only counts as finished once that step has released its cores, so no new
+    // job can touch the same data (e.g. a shm segment) while it winds down.
+    // Returns false in that case; the step then reports JOB_CANCELLED itself.
+    bool cancel(const shared_ptr<Job>& job) {
+        lock_guard<mutex> lock(m_mutex);
+        job->dropped = true;
+        job->control.cancelled.store(true, memory_order_relaxed);
+        erase(m_queue, job);
+        if (job->running) return false;
+        job->finished.store(true, memory_order_release);
+        return true;
+    }
+
+    JobStatus status(const Job& job) {
+        lock_guard<mutex> lock(m_mutex);
+        JobStatus st;
+        st.running = job.running;
+        double ahead = 0;
+        for (size_t i = 0; i < m_queue.size(); i++) {
+            if (m_queue[i].get() == &job) {
+                st.position = i + 1;
+                break;
+            }
+            ahead += remainingCoreSeconds(*m_queue[i]);
+        }
+        if (m_coreSecPerElem > 0) {
+            double own = remainingCoreSeconds(job);
+            double ownWall = 0;
+            for (size_t i = job.next; i < job.configs().size(); i++)
+                ownWall += stepCoreSeconds(job) / coresFor(job.configs()[i]);
+            st.eta = max(ownWall, (ahead + own) / m_budget);
+        }
+        return st;
+    }
+
+private:
+    int coresFor(int threads) const { return min(threads, m_budget); }
+    int coresFor(const Job& job) const { return coresFor(job.configs()[job.next]); }
+
+    double stepCoreSeconds(const Job& job) const {
+        return (double)job.n() * job.n() * m_coreSecPerElem;
+    }
+
+    double remainingCoreSeconds(const Job& job) const {
+        return stepCoreSeconds(job) * (double)(job.configs().size() - job.next);
+    }
+
+    void dispatchLoop() {
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [&] {
+                return !m_queue.empty() && m_freeCores >= coresFor(*m_queue.front());
+            });
+            shared_ptr<Job> job = m_queue.front();
+            m_queue.pop_front();
+            int cores = coresFor(*job);
+            m_freeCores -= cores;
+            job->running = true;
+            thread(&JobScheduler::runStep, this, job, cores).detach();
+        }
     }
-    ct.times.clear();
-    ct.currentIndex = 0;
-    ct.isProcessing = true;
-    for (size_t i = 0; i < ct.threadConfigs.size(); ++i) {
-        ct.currentIndex = i;
-        int threads_num = ct.threadConfigs[i];
-        vector<vector<int>> work = ct.baseMatrix;
+
+    void runStep(shared_ptr<Job> job, int cores) {
+        const MatrixUpload& up = *job->upload;
+        size_t i = job->next;
+        int threads_num = up.threadConfigs[i];
+        job->currentIndex.store(i, memory_order_relaxed);
+        // A shared segment is transposed in place, so consecutive configs
+        // alternate between the original and its transpose.
+        double cachedSec;
+        if (!up.shm && g_cache.findTiming(up.hash, KERNEL_NAME, threads_num, cachedSec)) {
+            finishStep(job, cores, cachedSec, true);
+            return;
+        }
+        vector<int32_t> work;
+        int32_t* data;
+        if (up.shm) {
+            data = up.shm->data;
+        } else {
+            work = *up.baseMatrix;
+            data = work.data();
+        }
+        job->control.tilesDone.store(0, memory_order_relaxed);
+        size_t lastTiles = SIZE_MAX;
+        auto report = [&] {
+            size_t done = job->control.tilesDone.load(memory_order_relaxed);
+            if (done == lastTiles || job->control.cancelled.load(memory_order_relaxed)) return;
+            lastTiles = done;
+            if (shared_ptr<Session> session = g_sessions.find(job->sessionId.load()))
+                session->send("PROGRESS: config=" + to_string(i + 1) + "/" + to_string(up.threadConfigs.size()) +
+                              ", tiles=" + to_string(done) + "/" +
+                              to_string(job->control.tilesTotal.load(memory_order_relaxed)));
+        };
         auto start = high_resolution_clock::now();
-        transpose_multi(work, threads_num);
+        transpose_multi(data, up.n, threads_num, cores, &job->control, report, m_progressInterval);
         auto end = high_resolution_clock::now();
         double sec = duration<double>(end - start).count();
-        ct.times.push_back(sec);
-        string info = "INFO: threads=" + to_string(threads_num) + ", time=" + to_string(sec) + " s";
-        sendCommand(cs, info);
+        bool cancelled = job->control.cancelled.load(memory_order_relaxed);
+        if (!up.shm && !cancelled)
+            g_cache.storeTiming(up.hash, KERNEL_NAME, threads_num, sec);
+        finishStep(job, cores, sec, false);
     }
-    ct.isProcessing = false;
-    sendCommand(cs, "TRANSPOSE_COMPLETED");
+
+    void finishStep(const shared_ptr<Job>& job, int cores, double sec, bool cached) {
+        const MatrixUpload& up = *job->upload;
+        size_t i = job->next;
+        int threads_num = up.threadConfigs[i];
+        if (!job->control.cancelled.load(memory_order_relaxed)) {
+            job->times[i] = sec;
+            // transpose_multi never runs more threads than rows.
+            job->effectiveThreads[i] = min(cores, up.n);
+            job->completed.store(i + 1, memory_order_release);
+        }
+        bool finished = false;
+        bool dropped;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_freeCores += cores;
+            job->running = false;
+            job->next++;
+            dropped = job->dropped;
+            if (!dropped && !cached) {
+                double sample = sec * cores / ((double)up.n * up.n);
+                m_coreSecPerElem = m_coreSecPerElem > 0 ? 0.8 * m_coreSecPerElem + 0.2 * sample : sample;
+            }
+            if (!dropped && job->next < up.threadConfigs.size())
+                m_queue.push_back(job);
+            else
+                finished = true;
+        }
+        m_cv.notify_all();
+        if (finished) job->finished.store(true, memory_order_release);
+
+        shared_ptr<Session> session = g_sessions.find(job->sessionId.load());
+        if (!session) return;
+        if (dropped) {
+            session->send("JOB_CANCELLED");
+            return;
+        }
+        string info = "INFO: threads=" + to_string(threads_num) + effectiveNote(threads_num, min(cores, up.n)) +
+                      ", time=" + to_string(sec) + " s" + (cached ? " (cached)" : "");
+        session->send(info);
+        if (finished)
+            session->send("TRANSPOSE_COMPLETED");
+    }
+
+    mutex m_mutex;
+    condition_variable m_cv;
+    deque<shared_ptr<Job>> m_queue;
+    int m_budget = 1;
+    int m_freeCores = 1;
+    size_t m_maxQueued = 16;
+    milliseconds m_progressInterval{100};
+    double m_coreSecPerElem = 0;
+};
+
+JobScheduler g_scheduler;
+
+// Jobs whose client went away before collecting the results. They keep
+// running; a new connection takes one over with ATTACH_JOB <id>. Unclaimed
+// jobs are let go once they have been finished for the TTL.
+class ParkedJobs {
+public:
+    void start(seconds ttl) {
+        m_ttl = ttl;
+        thread(&ParkedJobs::sweepLoop, this).detach();
+    }
+
+    void park(const shared_ptr<Job>& job) {
+        job->sessionId.store(0);
+        lock_guard<mutex> lock(m_mutex);
+        m_jobs[job->id] = Entry{job, steady_clock::now() + m_ttl};
+    }
+
+    shared_ptr<Job> claim(uint64_t id) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_jobs.find(id);
+        if (it == m_jobs.end()) return nullptr;
+        shared_ptr<Job> job = move(it->second.job);
+        m_jobs.erase(it);
+        return job;
+    }
+
+private:
+    struct Entry {
+        shared_ptr<Job> job;
+        steady_clock::time_point expires;
+    };
+
+    void sweepLoop() {
+        while (true) {
+            this_thread::sleep_for(min<steady_clock::duration>(m_ttl, seconds(1)));
+            auto now = steady_clock::now();
+            lock_guard<mutex> lock(m_mutex);
+            for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+                // The TTL only starts counting once the job is done.
+                if (!it->second.job->finished.load())
+                    it->second.expires = now + m_ttl;
+                if (now < it->second.expires) {
+                    ++it;
+                    continue;
+                }
+                cout << "[server] results of job " << it->first << " expired\n";
+                it = m_jobs.erase(it);
+            }
+        }
+    }
+
+    mutex m_mutex;
+    unordered_map<uint64_t, Entry> m_jobs;
+    steady_clock::duration m_ttl = seconds(300);
+};
+
+ParkedJobs g_parked;
+
+// Swaps rows [i0, i1) x columns [j0, j1) with their mirror, TILE by TILE.
+void swapBlock(int32_t* a, int n, int i0, int i1, int j0, int j1) {
+    for (int ii = i0; ii < i1; ii += TILE)
+        for (int jj = j0; jj < j1; jj += TILE)
+            for (int i = ii; i < min(ii + TILE, i1); i++)
+                for (int j = max(jj, i + 1); j < min(jj + TILE, j1); j++)
+                    swap(a[(size_t)i * n + j], a[(size_t)j * n + i]);
+}
+
+// Streaming transpose. Row blocks arrive in order; once block r is in, every
+// tile (b, r) with b <= r has both of its row blocks and is handed to the
+// workers, so compute overlaps the upload. A result row block is final when
+// all K tiles touching it are done and is sent back right away.
+bool streamTranspose(int cs, int n, int blockRows, int cores, double& uploadSec, double& totalSec) {
+    int K = (n + blockRows - 1) / blockRows;
+    vector<int32_t> a((size_t)n * n);
+    mutex m;
+    condition_variable cv;
+    deque<pair<int, int>> tiles;
+    deque<int> finished;
+    vector<int> pending(K, K);
+    bool inputDone = false;
+    bool aborted = false;
+
+    auto rowsOf = [&](int b) { return min(blockRows, n - b * blockRows); };
+    vector<thread> workers;
+    for (int w = 0; w < cores; w++) {
+        workers.emplace_back([&] {
+            while (true) {
+                pair<int, int> t;
+                {
+                    unique_lock<mutex> lock(m);
+                    cv.wait(lock, [&] { return aborted || !tiles.empty() || inputDone; });
+                    if (aborted || tiles.empty()) return;
+                    t = tiles.front();
+                    tiles.pop_front();
+                }
+                auto [bi, bj] = t;
+                swapBlock(a.data(), n, bi * blockRows, bi * blockRows + rowsOf(bi),
+                          bj * blockRows, bj * blockRows + rowsOf(bj));
+                lock_guard<mutex> lock(m);
+                if (--pending[bi] == 0) finished.push_back(bi);
+                if (bi != bj && --pending[bj] == 0) finished.push_back(bj);
+                cv.notify_all();
+            }
+        });
+    }
+    auto stop = [&](bool abort) {
+        {
+            lock_guard<mutex> lock(m);
+            aborted = abort;
+            inputDone = true;
+        }
+        cv.notify_all();
+        for (auto& w : workers) w.join();
+    };
+
+    auto start = high_resolution_clock::now();
+    for (int b = 0; b < K; b++) {
+        int32_t* rows = a.data() + (size_t)b * blockRows * n;
+        int bytes = rowsOf(b) * n * 4;
+        if (recvAll(cs, (char*)rows, bytes) != bytes) {
+            stop(true);
+            return false;
+        }
+        for (size_t k = 0; k < (size_t)rowsOf(b) * n; k++)
+            rows[k] = ntohl(rows[k]);
+        lock_guard<mutex> lock(m);
+        for (int bi = 0; bi <= b; bi++)
+            tiles.emplace_back(bi, b);
+        cv.notify_all();
+    }
+    uploadSec = duration<double>(high_resolution_clock::now() - start).count();
+
+    vector<int32_t> out((size_t)blockRows * n);
+    bool ok = true;
+    for (int sent = 0; sent < K && ok; sent++) {
+        int b;
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [&] { return !finished.empty(); });
+            b = finished.front();
+            finished.pop_front();
+        }
+        const int32_t* rows = a.data() + (size_t)b * blockRows * n;
+        size_t count = (size_t)rowsOf(b) * n;
+        for (size_t k = 0; k < count; k++)
+            out[k] = htonl(rows[k]);
+        StreamBlockHeader hdr{htonl(b * blockRows), htonl(rowsOf(b))};
+        ok = sendCommand(cs, "RESULT_BLOCK") &&
+             sendAll(cs, (char*)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+             sendAll(cs, (char*)out.data(), (int)(count * 4)) == (int)(count * 4);
+    }
+    stop(!ok);
+    totalSec = duration<double>(high_resolution_clock::now() - start).count();
+    return ok;
+}
+
+// Out-of-place transpose of a rows x cols tile, TILE by TILE.
+void transposeBlock(const int32_t* in, int32_t* out, int rows, int cols) {
+    for (int i0 = 0; i0 < rows; i0 += TILE)
+        for (int j0 = 0; j0 < cols; j0 += TILE)
+            for (int i = i0; i < min(i0 + TILE, rows); i++)
+                for (int j = j0; j < min(j0 + TILE, cols); j++)
+                    out[(size_t)j * rows + i] = in[(size_t)i * cols + j];
+}
+
+// Worker servers a coordinator ships tiles to (--workers host:port,...). Empty
+// unless this instance is a coordinator.
+struct WorkerAddr {
+    string name;
+    sockaddr_in addr{};
+};
+
+vector<WorkerAddr> g_workers;
+int g_workerConns = 2;
+// How long a worker may take over one tile, upload to answer, before the
+// tile goes to another connection and this one is dropped (--tile-timeout).
+milliseconds g_tileTimeout{30000};
+
+bool parseWorkers(const string& list, vector<WorkerAddr>& out) {
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        size_t colon = item.rfind(':');
+        if (colon == string::npos) return false;
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if (getaddrinfo(item.substr(0, colon).c_str(), item.substr(colon + 1).c_str(), &hints, &res) != 0)
+            return false;
+        WorkerAddr w;
+        w.name = item;
+        memcpy(&w.addr, res->ai_addr, sizeof(w.addr));
+        freeaddrinfo(res);
+        out.push_back(w);
+    }
+    return !out.empty();
+}
+
+struct WorkerLink {
+    int socket;
+    const WorkerAddr* worker;
+};
+
+// Opens g_workerConns connections to every worker. Each connection carries one
+// tile at a time, so a second one keeps a worker busy while the first tile's
+// result is still on the wire.
+vector<WorkerLink> connectWorkers() {
+    vector<WorkerLink> links;
+    for (const WorkerAddr& w : g_workers) {
+        for (int c = 0; c < g_workerConns; c++) {
+            int s = socket(AF_INET, SOCK_STREAM, 0);
+            if (s < 0) break;
+            if (connect(s, (const sockaddr*)&w.addr, sizeof(w.addr)) < 0) {
+                close(s);
+                cout << "[server] worker " << w.name << " unreachable\n";
+                break;
+            }
+            int one = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            links.push_back({s, &w});
+        }
+    }
+    return links;
+}
+
+// Sends (`out`) or receives `len` bytes on `s`, giving up at `deadline`. A
+// worker that hangs with its connection open never errors the socket, so
+// without the deadline it would stall its tile, and the stream, for good.
+bool transferBy(int s, char* p, size_t len, bool out, steady_clock::time_point deadline) {
+    while (len > 0) {
+        long long left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        pollfd pfd{s, (short)(out ? POLLOUT : POLLIN), 0};
+        if (left <= 0 || poll(&pfd, 1, (int)min<long long>(left, INT32_MAX)) <= 0) return false;
+        ssize_t r = out ? send(s, p, len, MSG_DONTWAIT | MSG_NOSIGNAL) : recv(s, p, len, MSG_DONTWAIT);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= (size_t)r;
+    }
+    return true;
 }
 
-void serveClient(int cs) {
-    cout << "[server] client connected: " << cs << "\n";
-    g_clients[cs] = ClientTask{};
+bool transposeRemote(int s, const int32_t* tile, int rows, int cols, int32_t* out) {
+    auto deadline = steady_clock::now() + g_tileTimeout;
+    const string name = "TRANSPOSE_BLOCK";
+    CommandPacket cmd{};
+    cmd.length = htonl((uint32_t)name.size());
+    memcpy(cmd.command, name.data(), name.size());
+    BlockInfo info{htonl(rows), htonl(cols)};
+    size_t bytes = (size_t)rows * cols * 4;
+    CommandPacket reply{};
+    return transferBy(s, (char*)&cmd, sizeof(cmd), true, deadline) &&
+           transferBy(s, (char*)&info, sizeof(info), true, deadline) &&
+           transferBy(s, (char*)tile, bytes, true, deadline) &&
+           transferBy(s, (char*)&reply, sizeof(reply), false, deadline) &&
+           string(reply.command, min<uint32_t>(ntohl(reply.length), sizeof(reply.command))) == "BLOCK_TRANSPOSED" &&
+           transferBy(s, (char*)out, bytes, false, deadline);
+}
+
+// Destination of a distributed transpose: an unlinked file under g_resultDir,
+// mapped shared, so the result lives in the page cache and can be written
+// back to disk instead of having to fit in this process's memory.
+string g_resultDir = "/var/tmp";
+
+shared_ptr<SharedSegment> createResultFile(size_t bytes) {
+    string path = g_resultDir + "/lab4_result_XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0) return nullptr;
+    unlink(path.c_str());
+    shared_ptr<SharedSegment> seg;
+    if (ftruncate(fd, (off_t)bytes) == 0)
+        seg = mapSegment(fd, bytes, false);
+    close(fd);
+    return seg;
+}
+
+// Drops the pages of [p, p + bytes) that are fully inside the range from this
+// process; they stay in the page cache (and the file) if needed again.
+void releasePages(void* p, size_t bytes) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)p + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t)p + bytes) & ~(page - 1);
+    if (lo < hi) madvise((void*)lo, hi - lo, MADV_DONTNEED);
+}
+
+// Coordinator side of STREAM_TRANSPOSE. Every uploaded row block is cut into K
+// square tiles that go on a shared queue; each worker connection takes a tile,
+// has the worker transpose it and writes the result straight into `result`,
+// so the workers run while the upload is still arriving. Only the tiles that
+// are queued or in flight are held in memory: the upload is not read further
+// while more than two row blocks' worth is outstanding. Result row block c is
+// final once all K tiles of input column block c are back. A connection that
+// fails, or whose worker misses the tile deadline, puts its tile back at the
+// front of the queue for the others and retires; the transpose fails only
+// when no connection is left. Payload stays
+// in wire byte order throughout, since the coordinator never looks at it.
+// Workers on the coordinator's own host only add copies and loopback traffic
+// over the local kernel; the point is workers on other machines.
+bool distributedTranspose(int cs, int n, int blockRows, vector<WorkerLink> links, SharedSegment& result,
+                          double& uploadSec, double& totalSec) {
+    struct Tile {
+        int b, c;
+        vector<int32_t> data;
+    };
+    int K = (n + blockRows - 1) / blockRows;
+    int32_t* t = result.data;
+    mutex m;
+    condition_variable cv;
+    deque<Tile> tiles;
+    deque<int> finished;
+    vector<int> pending(K, K);
+    size_t tilesLeft = (size_t)K * K;
+    size_t outstanding = 0;
+    int live = (int)links.size();
+    bool aborted = false;
+
+    auto rowsOf = [&](int b) { return min(blockRows, n - b * blockRows); };
+    vector<thread> conns;
+    for (const WorkerLink& link : links) {
+        conns.emplace_back([&, link] {
+            vector<int32_t> res;
+            while (true) {
+                Tile tile;
+                {
+                    unique_lock<mutex> lock(m);
+                    cv.wait(lock, [&] { return aborted || !tiles.empty() || tilesLeft == 0; });
+                    if (aborted || tiles.empty()) break;
+                    tile = move(tiles.front());
+                    tiles.pop_front();
+                }
+                int rows = rowsOf(tile.b), cols = rowsOf(tile.c);
+                res.resize((size_t)rows * cols);
+                if (!transposeRemote(link.socket, tile.data.data(), rows, cols, res.data())) {
+                    cout << "[server] worker " << link.worker->name
+                         << " failed or missed its tile deadline, reassigning its block\n";
+                    close(link.socket);
+                    lock_guard<mutex> lock(m);
+                    tiles.push_front(move(tile));
+                    live--;
+                    cv.notify_all();
+                    return;
+                }
+                for (int j = 0; j < cols; j++)
+                    memcpy(&t[((size_t)tile.c * blockRows + j) * n + (size_t)tile.b * blockRows],
+                           &res[(size_t)j * rows], (size_t)rows * 4);
+                lock_guard<mutex> lock(m);
+                tilesLeft--;
+                outstanding--;
+                if (--pending[tile.c] == 0) finished.push_back(tile.c);
+                cv.notify_all();
+            }
+            sendCommand(link.socket, "QUIT");
+            close(link.socket);
+        });
+    }
+    auto stop = [&](bool abort) {
+        {
+            lock_guard<mutex> lock(m);
+            aborted = abort;
+        }
+        cv.notify_all();
+        for (auto& c : conns) c.join();
+    };
+
+    auto start = high_resolution_clock::now();
+    vector<int32_t> rowBlock((size_t)blockRows * n);
+    for (int b = 0; b < K; b++) {
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [&] { return outstanding < (size_t)2 * K || live == 0; });
+        }
+        int rows = rowsOf(b);
+        int bytes = rows * n * 4;
+        if (recvAll(cs, (char*)rowBlock.data(), bytes) != bytes) {
+            stop(true);
+            return false;
+        }
+        for (int c = 0; c < K; c++) {
+            int cols = rowsOf(c);
+            Tile tile{b, c, vector<int32_t>((size_t)rows * cols)};
+            for (int i = 0; i < rows; i++)
+                memcpy(&tile.data[(size_t)i * cols], &rowBlock[(size_t)i * n + (size_t)c * blockRows],
+                       (size_t)cols * 4);
+            lock_guard<mutex> lock(m);
+            // With no worker left the rest of the upload is only drained.
+            if (live == 0) continue;
+            tiles.push_back(move(tile));
+            outstanding++;
+            cv.notify_all();
+        }
+    }
+    uploadSec = duration<double>(high_resolution_clock::now() - start).count();
+
+    bool ok = true;
+    for (int sent = 0; sent < K && ok; sent++) {
+        int c;
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [&] { return !finished.empty() || live == 0; });
+            if (finished.empty()) {
+                sendCommand(cs, "ERROR: NO WORKERS");
+                ok = false;
+                break;
+            }
+            c = finished.front();
+            finished.pop_front();
+        }
+        int32_t* rows = t + (size_t)c * blockRows * n;
+        int bytes = rowsOf(c) * n * 4;
+        StreamBlockHeader hdr{htonl(c * blockRows), htonl(rowsOf(c))};
+        ok = sendCommand(cs, "RESULT_BLOCK") &&
+             sendAll(cs, (char*)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+             sendAll(cs, (char*)rows, bytes) == bytes;
+        releasePages(rows, (size_t)bytes);
+    }
+    stop(!ok);
+    totalSec = duration<double>(high_resolution_clock::now() - start).count();
+    return ok;
+}
+
+void serveClient(int cs, bool local) {
+    shared_ptr<Session> session = g_sessions.create(cs, local);
+    cout << "[server] client connected: " << session->id << (local ? " (local)" : "")
+         << ", sessions: " << g_sessions.size() << "\n";
     try {
         string cmd;
         while (receiveCommand(cs, cmd)) {
             if (cmd == "HELLO") {
-                sendCommand(cs, "WELCOME");
+                session->send("WELCOME");
             } else if (cmd == "UPLOAD_MATRIX") {
-                MatrixUploadInfo info{};
-                if (recvAll(cs, (char*)&info, sizeof(info)) != sizeof(info))
+                auto up = make_shared<MatrixUpload>();
+                size_t bytes;
+                if (!receiveUploadHeader(cs, *up, bytes))
                     break;
-                int n = (int)ntohl(info.matrix_size);
-                int cfgCount = (int)ntohl(info.num_configs);
-                int bytes = (int)ntohl(info.matrix_bytes);
-                if (bytes != n * n * 4) break;
-                ClientTask& ct = g_clients[cs];
-                ct.baseMatrix.assign(n, vector<int>(n));
-                ct.threadConfigs.resize(cfgCount);
-                vector<int32_t> cfgNet(cfgCount);
-                if (recvAll(cs, (char*)cfgNet.data(), cfgCount * 4) != cfgCount * 4)
-                    break;
-                for (int i = 0; i < cfgCount; i++) {
-                    ct.threadConfigs[i] = ntohl(cfgNet[i]);
-                    if (ct.threadConfigs[i] <= 0) ct.threadConfigs[i] = 1;
-                }
-                int total = n * n;
-                vector<int32_t> flat(total);
-                if (recvAll(cs, (char*)flat.data(), total * 4) != total * 4)
-                    break;
-                int idx = 0;
-                for (int i = 0; i < n; i++)
-                    for (int j = 0; j < n; j++)
-                        ct.baseMatrix[i][j] = ntohl(flat[idx++]);
-                sendCommand(cs, "MATRIX_RECEIVED");
+                auto matrix = make_shared<vector<int32_t>>((size_t)up->n * up->n);
+                if (!receiveMatrix(cs, *matrix, bytes, up->hash))
+                    break;
+                up->baseMatrix = g_cache.insert(up->hash, up->n, move(matrix));
+                session->upload = up;
+                session->send("MATRIX_RECEIVED");
+            } else if (cmd.rfind("ENCODINGS ", 0) == 0) {
+                // The client lists what it can send; we answer with the subset we
+                // accept for UPLOAD_MATRIX_ENC (raw is always allowed).
+                session->encodings = 1u << ENC_RAW;
+                string reply = "ENCODINGS";
+                stringstream ss(cmd.substr(10));
+                string name;
+                while (getline(ss, name, ',')) {
+                    uint32_t enc;
+                    if (!parseEncoding(name, enc) || (session->encodings & (1u << enc))) continue;
+                    session->encodings |= 1u << enc;
+                    reply += (reply.size() > 9 ? "," : " ") + name;
+                }
+                session->send(reply);
+            } else if (cmd == "UPLOAD_MATRIX_ENC") {
+                auto up = make_shared<MatrixUpload>();
+                size_t bytes;
+                if (!receiveUploadHeader(cs, *up, bytes))
+                    break;
+                auto matrix = make_shared<vector<int32_t>>((size_t)up->n * up->n);
+                if (!receiveEncodedMatrix(cs, *matrix, bytes, session->encodings, up->hash)) {
+                    session->send("ERROR: BAD ENCODING");
+                    break;
+                }
+                up->baseMatrix = g_cache.insert(up->hash, up->n, move(matrix));
+                session->upload = up;
+                session->send("MATRIX_RECEIVED");
+            } else if (cmd == "UPLOAD_BY_HASH") {
+                auto up = make_shared<MatrixUpload>();
+                size_t bytes;
+                if (!receiveUploadHeader(cs, *up, bytes) || !receiveHash(cs, up->hash))
+                    break;
+                up->baseMatrix = g_cache.find(up->hash, up->n);
+                if (!up->baseMatrix) {
+                    session->send("HASH_UNKNOWN");
+                    continue;
+                }
+                session->upload = up;
+                session->send("MATRIX_RECEIVED");
+            } else if (cmd == "UPLOAD_MATRIX_SHM") {
+                auto up = make_shared<MatrixUpload>();
+                size_t bytes;
+                if (!receiveUploadHeader(cs, *up, bytes))
+                    break;
+                int fd = recvFd(cs);
+                if (fd < 0) {
+                    session->upload.reset();
+                    session->send("ERROR: NO SHM");
+                    continue;
+                }
+                up->shm = mapSegment(fd, bytes, true);
+                close(fd);
+                if (!up->shm) {
+                    session->upload.reset();
+                    session->send("ERROR: BAD SHM");
+                    continue;
+                }
+                session->upload = up;
+                session->send("MATRIX_RECEIVED");
             } else if (cmd == "START_TRANSPOSE") {
-                ClientTask& ct = g_clients[cs];
-                if (ct.baseMatrix.empty() || ct.threadConfigs.empty()) {
-                    sendCommand(cs, "ERROR: NO DATA");
+                if (!session->upload || session->upload->n == 0 ||
+                    session->upload->threadConfigs.empty()) {
+                    session->send("ERROR: NO DATA");
                     continue;
                 }
-                if (ct.isProcessing) {
-                    sendCommand(cs, "ERROR: ALREADY");
+                if (session->processing()) {
+                    bool cancelling = session->job->control.cancelled.load(memory_order_relaxed);
+                    session->send(cancelling ? "ERROR: CANCELLING" : "ERROR: ALREADY");
                     continue;
                 }
-                sendCommand(cs, "TRANSPOSE_STARTED");
-                thread(processingThreadFunc, cs).detach();
+                auto job = make_shared<Job>();
+                job->sessionId.store(session->id);
+                job->upload = session->upload;
+                job->times.resize(job->configs().size());
+                job->effectiveThreads.resize(job->configs().size());
+                size_t position = 0;
+                // A cached or tiny step can finish before submit() returns; its
+                // INFO and TRANSPOSE_COMPLETED wait on the send lock behind us.
+                unique_lock<mutex> sending = session->lockSend();
+                switch (g_scheduler.submit(job, position)) {
+                case JobScheduler::Admission::Started:
+                    session->job = job;
+                    session->sendLocked("TRANSPOSE_STARTED: job=" + to_string(job->id));
+                    break;
+                case JobScheduler::Admission::Queued:
+                    session->job = job;
+                    session->sendLocked("TRANSPOSE_QUEUED: position=" + to_string(position) +
+                                        ", job=" + to_string(job->id));
+                    break;
+                case JobScheduler::Admission::Busy:
+                    session->sendLocked("ERROR: BUSY");
+                    break;
+                }
+            } else if (cmd == "STREAM_TRANSPOSE") {
+                StreamInfo info{};
+                if (recvAll(cs, (char*)&info, sizeof(info)) != sizeof(info))
+                    break;
+                int n = (int)ntohl(info.matrix_size);
+                int threads = max(1, (int)ntohl(info.threads));
+                int blockRows = (int)ntohl(info.block_rows);
+                // A coordinator never holds the whole matrix, only row blocks.
+                if (n <= 0 || blockRows <= 0 || blockRows > n || (size_t)blockRows * n * 4 > INT32_MAX ||
+                    (g_workers.empty() && (size_t)n * n * 4 > INT32_MAX))
+                    break;
+                // Results are written straight to the socket, so nothing else may
+                // be reporting on this session meanwhile.
+                if (session->processing()) {
+                    session->send("ERROR: ALREADY");
+                    break;
+                }
+                if (!g_workers.empty()) {
+                    shared_ptr<SharedSegment> result = createResultFile((size_t)n * n * 4);
+                    if (!result) {
+                        session->send("ERROR: NO RESULT FILE");
+                        continue;
+                    }
+                    vector<WorkerLink> links = connectWorkers();
+                    if (links.empty()) {
+                        session->send("ERROR: NO WORKERS");
+                        continue;
+                    }
+                    size_t conns = links.size();
+                    session->send("STREAM_READY");
+                    double uploadSec = 0, totalSec = 0;
+                    if (!distributedTranspose(cs, n, blockRows, move(links), *result, uploadSec, totalSec))
+                        break;
+                    session->send("STREAM_COMPLETED: workers=" + to_string(g_workers.size()) +
+                                  ", connections=" + to_string(conns) + ", upload=" + to_string(uploadSec) +
+                                  " s, total=" + to_string(totalSec) + " s");
+                    continue;
+                }
+                int cores = g_scheduler.acquireCores(threads);
+                session->send("STREAM_READY");
+                double uploadSec = 0, totalSec = 0;
+                bool ok = streamTranspose(cs, n, blockRows, cores, uploadSec, totalSec);
+                g_scheduler.releaseCores(cores);
+                if (!ok) break;
+                session->send("STREAM_COMPLETED: threads=" + to_string(threads) + effectiveNote(threads, cores) +
+                              ", upload=" + to_string(uploadSec) + " s, total=" + to_string(totalSec) + " s");
+            } else if (cmd == "TRANSPOSE_BLOCK") {
+                BlockInfo info{};
+                if (recvAll(cs, (char*)&info, sizeof(info)) != sizeof(info))
+                    break;
+                int rows = (int)ntohl(info.rows);
+                int cols = (int)ntohl(info.cols);
+                if (rows <= 0 || cols <= 0 || (size_t)rows * cols * 4 > INT32_MAX)
+                    break;
+                if (session->processing()) {
+                    session->send("ERROR: ALREADY");
+                    break;
+                }
+                int bytes = rows * cols * 4;
+                vector<int32_t> in((size_t)rows * cols), out((size_t)rows * cols);
+                if (recvAll(cs, (char*)in.data(), bytes) != bytes)
+                    break;
+                int cores = g_scheduler.acquireCores(1);
+                transposeBlock(in.data(), out.data(), rows, cols);
+                g_scheduler.releaseCores(cores);
+                if (!session->send("BLOCK_TRANSPOSED") ||
+                    sendAll(cs, (char*)out.data(), bytes) != bytes)
+                    break;
             } else if (cmd == "REQUEST_STATUS") {
-                ClientTask& ct = g_clients[cs];
-                if (!ct.isProcessing)
-                    sendCommand(cs, "STATUS: FINISHED");
-                else {
-                    string s = "STATUS: " + to_string(ct.currentIndex + 1) +
-                               "/" + to_string(ct.threadConfigs.size());
-                    sendCommand(cs, s);
+                if (!session->processing()) {
+                    session->send("STATUS: FINISHED");
+                } else {
+                    const Job& job = *session->job;
+                    JobStatus st = g_scheduler.status(job);
+                    string s = "STATUS: " + to_string(job.currentIndex.load(memory_order_relaxed) + 1) +
+                               "/" + to_string(job.configs().size());
+                    if (st.running)
+                        s += ", running, tiles=" + to_string(job.control.tilesDone.load(memory_order_relaxed)) +
+                             "/" + to_string(job.control.tilesTotal.load(memory_order_relaxed));
+                    else
+                        s += ", queue position=" + to_string(st.position);
+                    s += st.eta < 0 ? ", eta=unknown" : ", eta=" + to_string(st.eta) + " s";
+                    session->send(s);
+                }
+            } else if (cmd == "CANCEL_JOB") {
+                if (!session->processing()) {
+                    session->send("ERROR: NO JOB");
+                    continue;
+                }
+                if (session->job->control.cancelled.load(memory_order_relaxed)) {
+                    session->send("ERROR: CANCELLING");
+                    continue;
                 }
+                // An in-place (shared memory) step stopped midway leaves the
+                // segment partially transposed; the client owns it and knows.
+                if (g_scheduler.cancel(session->job))
+                    session->send("JOB_CANCELLED");
             } else if (cmd == "REQUEST_RESULTS") {
-                ClientTask& ct = g_clients[cs];
-                if (ct.times.empty()) {
-                    sendCommand(cs, "ERROR: NO RESULTS");
+                shared_ptr<Job> job = session->job;
+                size_t done = job ? job->completed.load(memory_order_acquire) : 0;
+                if (done == 0) {
+                    session->send("ERROR: NO RESULTS");
                     continue;
                 }
                 string report = "RESULT:\n";
-                report += "Matrix " + to_string(ct.baseMatrix.size()) + "x" + to_string(ct.baseMatrix.size()) + "\n";
-                for (size_t i = 0; i < ct.threadConfigs.size(); i++)
-                    report += to_string(ct.threadConfigs[i]) + " threads: " +
-                              to_string(ct.times[i]) + " s\n";
-                sendCommand(cs, report);
+                report += "Matrix " + to_string(job->n()) + "x" + to_string(job->n()) + "\n";
+                for (size_t i = 0; i < done; i++)
+                    report += to_string(job->configs()[i]) + " threads" +
+                              effectiveNote(job->configs()[i], job->effectiveThreads[i]) + ": " +
+                              to_string(job->times[i]) + " s\n";
+                if (session->send(report) && done == job->configs().size())
+                    job->delivered.store(true);
+            } else if (cmd.rfind("ATTACH_JOB ", 0) == 0) {
+                if (session->processing()) {
+                    session->send("ERROR: ALREADY");
+                    continue;
+                }
+                shared_ptr<Job> job = g_parked.claim(strtoull(cmd.c_str() + 11, nullptr, 10));
+                if (!job) {
+                    session->send("ERROR: NO JOB");
+                    continue;
+                }
+                session->job = job;
+                session->upload = job->upload;
+                // Pushes from a step ending meanwhile go to us only after the
+                // reply; `finished` is read after taking them over, so the end
+                // of the job is reported here, by the step, or both.
+                unique_lock<mutex> sending = session->lockSend();
+                job->sessionId.store(session->id);
+                session->sendLocked(job->finished.load() ? "JOB_ATTACHED: finished" : "JOB_ATTACHED: running");
             } else if (cmd == "QUIT") {
-                sendCommand(cs, "BYE");
+                session->send("BYE");
                 break;
             } else {
-                sendCommand(cs, "ERROR");
+                session->send("ERROR");
             }
         }
     } catch (...) {}
-    close(cs);
-    g_clients.erase(cs);
-    cout << "[server] client disconnected: " << cs << "\n";
+    // The job outlives the connection: results nobody has collected yet are
+    // parked for a later ATTACH_JOB. A cancelled job is simply let go.
+    if (session->job && !session->job->delivered.load() &&
+        !session->job->control.cancelled.load(memory_order_relaxed))
+        g_parked.park(session->job);
+    // Wake up any step still sending to us; the fd itself is closed together
+    // with the last session reference.
+    shutdown(cs, SHUT_RDWR);
+    g_sessions.remove(session->id);
+    cout << "[server] client disconnected: " << session->id << "\n";
+}
+
+void serveLocal() {
+    int localSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (localSocket < 0) return;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SHM_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    unlink(SHM_SOCKET_PATH);
+    if (::bind(localSocket, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(localSocket, SOMAXCONN) < 0) {
+        perror("[server] local socket");
+        close(localSocket);
+        return;
+    }
+
+    cout << "[server] shared-memory transport on " << SHM_SOCKET_PATH << "\n";
+
+    while (true) {
+        int clientSocket = accept(localSocket, nullptr, nullptr);
+        if (clientSocket < 0) continue;
+        thread(serveClient, clientSocket, true).detach();
+    }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    int cores = (int)thread::hardware_concurrency();
+    size_t maxQueued = 16;
+    int progressMs = 100;
+    size_t cacheMb = 1024;
+    int resultTtl = 300;
+    int port = PORT;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--port") port = atoi(argv[i + 1]);
+        else if (arg == "--workers" && !parseWorkers(argv[i + 1], g_workers)) {
+            cerr << "[server] bad --workers list: " << argv[i + 1] << "\n";
+            return 1;
+        }
+        else if (arg == "--worker-conns") g_workerConns = max(1, atoi(argv[i + 1]));
+        else if (arg == "--tile-timeout") g_tileTimeout = milliseconds(max(1, atoi(argv[i + 1])) * 1000LL);
+        else if (arg == "--result-dir") g_resultDir = argv[i + 1];
+        else if (arg == "--cores") cores = atoi(argv[i + 1]);
+        else if (arg == "--max-queue") maxQueued = (size_t)atoi(argv[i + 1]);
+        else if (arg == "--progress-ms") progressMs = max(1, atoi(argv[i + 1]));
+        else if (arg == "--cache-mb") cacheMb = (size_t)atoll(argv[i + 1]);
+        else if (arg == "--result-ttl") resultTtl = max(1, atoi(argv[i + 1]));
+    }
+    g_cache.configure(cacheMb << 20);
+    g_scheduler.configure(cores, maxQueued, milliseconds(progressMs));
+    g_scheduler.start();
+    g_parked.start(seconds(resultTtl));
+
     int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket < 0) return 1;
     int opt = 1;
     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(12345);
+    addr.sin_port = htons(port);
     addr.sin_addr.s_addr = INADDR_ANY;
     if (::bind(serverSocket, (sockaddr*)&addr, sizeof(addr)) < 0) return 1;
     if (listen(serverSocket, SOMAXCONN) < 0) return 1;
 
-    cout << "[server] listening on port 12345\n";
+    cout << "[server] listening on port " << port << ", core budget " << g_scheduler.budget()
+         << ", queue limit " << maxQueued << "\n";
+    if (!g_workers.empty())
+        cout << "[server] coordinating " << g_workers.size() << " workers, "
+             << g_workerConns << " connections each\n";
+    // The shared-memory socket has a fixed path, so only the instance on the
+    // default port owns it; extra instances (e.g. workers) are TCP only.
+    if (port == PORT)
+        thread(serveLocal).detach();
 
     while (true) {
         int clientSocket = accept(serverSocket, nullptr, nullptr);
         if (clientSocket < 0) continue;
-        thread(serveClient, clientSocket).detach();
+        // Replies are small packets, often right after another write (a
+        // command and its payload); Nagle would hold them for the peer's
+        // delayed ACK, which is most of a short request's latency.
+        setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        thread(serveClient, clientSocket, false).detach();
     }
 
     close(serverSocket);
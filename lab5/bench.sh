@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+# Runs the Locust profile from locustfile.py against each server engine in
+# turn and keeps the CSVs side by side as result_<engine>_*.csv. With LOADGEN
+# set, the native open-loop generator replays the same mix at RATE req/s
+# instead, which can actually saturate the server. Without SERVER, the CMake
+# targets are built (Release) into BUILD_DIR first.
+#
+#   USERS=500 TIME=2m ./bench.sh epoll uring
+#   LOADGEN=build/loadgen RATE=50000 ./bench.sh threads epoll uring
+#   SERVER=../cmake-build-release/5 ./bench.sh epoll
+set -euo pipefail
+cd "$(dirname "$0")"
+
+BUILD_DIR=${BUILD_DIR:-build}
+if [ -z "${SERVER:-}" ]; then
+    cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release > /dev/null
+    cmake --build "$BUILD_DIR" --target 5 loadgen > /dev/null
+    SERVER=$BUILD_DIR/5
+fi
+USERS=${USERS:-200}
+SPAWN=${SPAWN:-50}
+TIME=${TIME:-60s}
+LOADGEN=${LOADGEN:-}
+RATE=${RATE:-20000}
+CONNECTIONS=${CONNECTIONS:-64}
+PIPELINE=${PIPELINE:-1}
+ENGINES=("$@")
+[ ${#ENGINES[@]} -eq 0 ] && ENGINES=(threads epoll uring)
+
+for engine in "${ENGINES[@]}"; do
+    echo "== $engine"
+    log=$(mktemp)
+    "$SERVER" --engine "$engine" > "$log" 2>&1 &
+    pid=$!
+    sleep 1
+    # A server that ignores --engine would quietly benchmark the same code
+    # under every name.
+    if ! grep -q "($engine)" "$log"; then
+        echo "$SERVER does not take --engine $engine" >&2
+        kill "$pid"
+        exit 1
+    fi
+    grep -q "falling back" "$log" && echo "warning: io_uring unavailable, this run is epoll" >&2
+    if [ -n "$LOADGEN" ]; then
+        "$LOADGEN" --rate "$RATE" --duration "$TIME" --connections "$CONNECTIONS" \
+            --pipeline "$PIPELINE" --csv "result_$engine" || true
+    else
+        locust -f locustfile.py --headless -u "$USERS" -r "$SPAWN" -t "$TIME" \
+            --host http://localhost:8080 --csv "result_$engine" --only-summary || true
+    fi
+    kill "$pid"
+    wait "$pid" 2>/dev/null || true
+    rm -f "$log"
+done
+
+for engine in "${ENGINES[@]}"; do
+    printf '%-8s ' "$engine"
+    grep '^,Aggregated' "result_${engine}_stats.csv" |
+        awk -F, '{ printf "requests=%s failures=%s median=%sms avg=%.1fms rps=%.1f\n", $3, $4, $5, $6, $10 }'
+done
@@ -0,0 +1,526 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+
+using namespace std;
+using namespace chrono;
+
+// Open-loop HTTP load generator for the lab5 server, in the manner of wrk2.
+// Every connection issues requests on a fixed schedule whether or not the
+// server keeps up, and latency is measured from the time a request was due
+// rather than the time it went out. A stalled server is therefore charged for
+// all the requests it kept waiting instead of hiding them (coordinated
+// omission). The request mix follows locustfile.py and the CSV has the same
+// columns as Locust's result_stats.csv, so the two can be compared directly.
+
+struct Route {
+    const char* path;
+    int weight;
+};
+
+const array<Route, 3> ROUTES = {{{"/", 2}, {"/page2.html", 1}, {"/nonexistent.html", 1}}};
+
+struct Options {
+    string host = "127.0.0.1";
+    int port = 8080;
+    double rate = 10000;  // requests per second over all connections
+    double seconds = 30;
+    int connections = 64;
+    int threads = 2;
+    int pipeline = 1;
+    bool keepAlive = true;
+    string csvPrefix = "loadgen";
+};
+
+// Whole-string numeric parses; they throw invalid_argument or out_of_range
+// on anything else, trailing junk, NaN and infinities included.
+int parseInt(const string& s) {
+    size_t used = 0;
+    long long v = stoll(s, &used);
+    if (used != s.size()) throw invalid_argument(s);
+    if (v < INT_MIN || v > INT_MAX) throw out_of_range(s);
+    return (int)v;
+}
+
+double parseReal(const string& s, size_t& used) {
+    double v = stod(s, &used);
+    if (!isfinite(v)) throw out_of_range(s);
+    return v;
+}
+
+double parseReal(const string& s) {
+    size_t used = 0;
+    double v = parseReal(s, used);
+    if (used != s.size()) throw invalid_argument(s);
+    return v;
+}
+
+// Accepts Locust's run-time syntax as well: 90, 90s, 2m, 1h.
+double parseDuration(const string& s) {
+    size_t used = 0;
+    double v = parseReal(s, used);
+    string unit = s.substr(used);
+    if (unit == "m") v *= 60;
+    else if (unit == "h") v *= 3600;
+    else if (!unit.empty() && unit != "s") throw invalid_argument(s);
+    return v;
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+    auto usage = [] {
+        cerr << "usage: loadgen [--host H] [--port P] [--rate req/s] [--duration 30s] [--connections N]\n"
+                "               [--threads T] [--pipeline D] [--no-keepalive] [--csv prefix]\n";
+        return false;
+    };
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            auto value = [&]() -> string { return i + 1 < argc ? argv[++i] : ""; };
+            if (arg == "--host") o.host = value();
+            else if (arg == "--port") o.port = parseInt(value());
+            else if (arg == "--rate") o.rate = parseReal(value());
+            else if (arg == "--duration") o.seconds = parseDuration(value());
+            else if (arg == "--connections") o.connections = parseInt(value());
+            else if (arg == "--threads") o.threads = parseInt(value());
+            else if (arg == "--pipeline") o.pipeline = parseInt(value());
+            else if (arg == "--no-keepalive") o.keepAlive = false;
+            else if (arg == "--csv") o.csvPrefix = value();
+            else return usage();
+        }
+    } catch (const logic_error&) {  // invalid_argument, out_of_range
+        return usage();
+    }
+    if (!o.keepAlive) o.pipeline = 1;
+    o.threads = max(1, min(o.threads, o.connections));
+    if (o.port <= 0 || o.port > 65535 || o.rate <= 0 || o.seconds <= 0 || o.connections <= 0 || o.pipeline <= 0)
+        return usage();
+    return true;
+}
+
+// Log-linear histogram in the style of HdrHistogram. Values below 2048 us are
+// exact and every power of two above that is split into 1024 buckets, so any
+// recorded latency up to 50 days keeps three significant digits in a fixed
+// 270 KB and histograms from several threads merge by adding counts.
+class Histogram {
+public:
+    Histogram() : m_counts(BUCKETS, 0) {}
+
+    void record(uint64_t us) {
+        us = std::min(us, MAX_VALUE);
+        m_counts[index(us)]++;
+        m_count++;
+        m_sum += us;
+        m_min = std::min(m_min, us);
+        m_max = std::max(m_max, us);
+    }
+
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < BUCKETS; i++) m_counts[i] += other.m_counts[i];
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? (double)m_sum / m_count : 0; }
+
+    // The smallest recorded value that at least a fraction `p` of all values
+    // are equal to or below, reported as the top of its bucket.
+    uint64_t percentile(double p) const {
+        if (m_count == 0) return 0;
+        uint64_t target = std::max<uint64_t>(1, (uint64_t)ceil(p * m_count));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += m_counts[i];
+            if (seen >= target) return std::min(highest(i), m_max);
+        }
+        return m_max;
+    }
+
+private:
+    static constexpr int SUB_BITS = 11;
+    static constexpr uint64_t SUB = 1ULL << SUB_BITS;
+    static constexpr uint64_t HALF = SUB / 2;
+    static constexpr int MAX_BITS = 42;
+    static constexpr uint64_t MAX_VALUE = (1ULL << MAX_BITS) - 1;
+    static constexpr size_t BUCKETS = SUB + (MAX_BITS - SUB_BITS) * HALF;
+
+    static size_t index(uint64_t v) {
+        if (v < SUB) return v;
+        int shift = 63 - __builtin_clzll(v) - (SUB_BITS - 1);  // v >> shift is in [HALF, SUB)
+        return SUB + (shift - 1) * HALF + ((v >> shift) - HALF);
+    }
+
+    static uint64_t highest(size_t i) {
+        if (i < SUB) return i;
+        int shift = (int)((i - SUB) / HALF) + 1;
+        uint64_t sub = (i - SUB) % HALF + HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    vector<uint64_t> m_counts;
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
+};
+
+struct RouteStats {
+    Histogram latency;
+    uint64_t failures = 0;
+    uint64_t bodyBytes = 0;
+
+    void merge(const RouteStats& other) {
+        latency.merge(other.latency);
+        failures += other.failures;
+        bodyBytes += other.bodyBytes;
+    }
+};
+
+using Stats = array<RouteStats, ROUTES.size()>;
+
+bool equalsNoCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+// Returns how many bytes the response at the front of `in` takes, 0 while it
+// is incomplete and SIZE_MAX when it is not HTTP at all.
+size_t parseResponse(string_view in, int& status, size_t& bodyLen, bool& close) {
+    size_t end = in.find("\r\n\r\n");
+    if (end == string_view::npos) return in.size() > 64 * 1024 ? SIZE_MAX : 0;
+    if (in.size() < 12 || in.substr(0, 7) != "HTTP/1." || !isdigit((unsigned char)in[9])) return SIZE_MAX;
+    status = atoi(string(in.substr(9, 3)).c_str());
+    bodyLen = 0;
+    close = false;
+    size_t pos = in.find("\r\n") + 2;
+    while (pos < end) {
+        size_t eol = in.find("\r\n", pos);
+        string_view line = in.substr(pos, eol - pos);
+        size_t colon = line.find(':');
+        if (colon != string_view::npos && equalsNoCase(line.substr(0, colon), "Content-Length"))
+            bodyLen = strtoull(string(line.substr(colon + 1)).c_str(), nullptr, 10);
+        else if (colon != string_view::npos && equalsNoCase(line.substr(0, colon), "Connection"))
+            close = line.find("close") != string_view::npos;
+        pos = eol + 2;
+    }
+    size_t total = end + 4 + bodyLen;
+    return in.size() < total ? 0 : total;
+}
+
+struct Pending {
+    size_t route;
+    steady_clock::time_point due;
+};
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    bool closing = false;  // the server announced it will close after a response
+    string out;
+    size_t outOff = 0;
+    string in;
+    deque<Pending> inflight;
+    steady_clock::time_point next;  // when the next request is due
+};
+
+// Drives one thread's share of the connections with poll(). Each connection
+// has its own schedule, offset from the others so arrivals are spread evenly.
+class Worker {
+public:
+    Worker(const Options& o, const sockaddr_in& addr, int first, int count, steady_clock::time_point start,
+           unsigned seed)
+        : m_o(o), m_addr(addr), m_conns(count), m_rng(seed) {
+        m_interval = duration_cast<nanoseconds>(duration<double>(o.connections / o.rate));
+        for (int i = 0; i < count; i++)
+            m_conns[i].next = start + m_interval * (first + i) / o.connections;
+        for (const Route& r : ROUTES) {
+            m_weights.push_back(r.weight);
+            m_requests.push_back(string("GET ") + r.path + " HTTP/1.1\r\nHost: " + o.host + "\r\n" +
+                                 (o.keepAlive ? "" : "Connection: close\r\n") + "\r\n");
+        }
+    }
+
+    void run(steady_clock::time_point end) {
+        discrete_distribution<size_t> pick(m_weights.begin(), m_weights.end());
+        vector<pollfd> fds(m_conns.size());
+        size_t depth = m_o.pipeline;
+        for (;;) {
+            auto now = steady_clock::now();
+            if (now >= end) break;
+            auto wake = end;
+            for (Conn& c : m_conns) {
+                while (c.next <= now && c.inflight.size() < depth) {
+                    size_t route = pick(m_rng);
+                    if (c.fd < 0 && !open(c)) {
+                        fail(route, c.next, now);
+                    } else {
+                        c.out += m_requests[route];
+                        c.inflight.push_back({route, c.next});
+                    }
+                    c.next += m_interval;
+                }
+                if (c.inflight.size() < depth) wake = min(wake, c.next);
+            }
+            for (size_t i = 0; i < m_conns.size(); i++) {
+                Conn& c = m_conns[i];
+                bool writing = c.connecting || c.outOff < c.out.size();
+                fds[i] = {c.fd, (short)(POLLIN | (writing ? POLLOUT : 0)), 0};
+            }
+            auto waitMs = duration_cast<milliseconds>(wake - now + microseconds(999)).count();
+            if (poll(fds.data(), fds.size(), (int)max<int64_t>(0, waitMs)) < 0 && errno != EINTR) break;
+            now = steady_clock::now();
+            for (size_t i = 0; i < m_conns.size(); i++) {
+                Conn& c = m_conns[i];
+                short ev = fds[i].revents;
+                if (c.fd < 0 || !ev) continue;
+                bool ok = !(ev & POLLOUT) || flush(c);
+                if (ok && (ev & (POLLIN | POLLHUP | POLLERR))) ok = receive(c, now);
+                if (!ok) drop(c, now);
+            }
+        }
+        for (Conn& c : m_conns)
+            if (c.fd >= 0) close(c.fd);
+    }
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    bool open(Conn& c) {
+        c.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (c.fd < 0) return false;
+        fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c.fd, (const sockaddr*)&m_addr, sizeof(m_addr)) < 0 && errno != EINPROGRESS) {
+            close(c.fd);
+            c.fd = -1;
+            return false;
+        }
+        c.connecting = true;
+        return true;
+    }
+
+    bool flush(Conn& c) {
+        if (c.connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) return false;
+            c.connecting = false;
+        }
+        while (c.outOff < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outOff, c.out.size() - c.outOff, 0);
+            if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+            c.outOff += n;
+        }
+        c.out.clear();
+        c.outOff = 0;
+        return true;
+    }
+
+    bool receive(Conn& c, steady_clock::time_point now) {
+        char buf[16384];
+        for (;;) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0) return false;
+            // The server closed. That is expected after a close response, and
+            // pipelined requests it never answered go out again on a new
+            // connection, still due when they first were.
+            if (!consume(c, now) || !c.closing) return false;
+            close(c.fd);
+            c.fd = -1;
+            c.closing = false;
+            c.in.clear();
+            c.out.clear();
+            c.outOff = 0;
+            if (c.inflight.empty()) return true;
+            if (!open(c)) return false;
+            for (const Pending& p : c.inflight) c.out += m_requests[p.route];
+            return true;
+        }
+        return consume(c, now);
+    }
+
+    bool consume(Conn& c, steady_clock::time_point now) {
+        size_t off = 0;
+        while (!c.inflight.empty()) {
+            int status;
+            size_t bodyLen;
+            bool closing;
+            size_t used = parseResponse(string_view(c.in).substr(off), status, bodyLen, closing);
+            if (used == SIZE_MAX) return false;
+            if (used == 0) break;
+            c.closing |= closing;
+            Pending p = c.inflight.front();
+            c.inflight.pop_front();
+            RouteStats& rs = m_stats[p.route];
+            rs.latency.record(duration_cast<microseconds>(now - p.due).count());
+            rs.bodyBytes += bodyLen;
+            if (status >= 400) rs.failures++;
+            off += used;
+        }
+        c.in.erase(0, off);
+        return true;
+    }
+
+    void fail(size_t route, steady_clock::time_point due, steady_clock::time_point now) {
+        RouteStats& rs = m_stats[route];
+        rs.latency.record(duration_cast<microseconds>(now - due).count());
+        rs.failures++;
+    }
+
+    // Counts everything still in flight as failed; the next due request
+    // opens a fresh connection.
+    void drop(Conn& c, steady_clock::time_point now) {
+        for (const Pending& p : c.inflight) fail(p.route, p.due, now);
+        c.inflight.clear();
+        close(c.fd);
+        c.fd = -1;
+        c.connecting = false;
+        c.closing = false;
+        c.in.clear();
+        c.out.clear();
+        c.outOff = 0;
+    }
+
+    const Options& m_o;
+    sockaddr_in m_addr;
+    vector<Conn> m_conns;
+    mt19937 m_rng;
+    nanoseconds m_interval;
+    vector<int> m_weights;
+    vector<string> m_requests;
+    Stats m_stats;
+};
+
+double ms(uint64_t us) {
+    return us / 1000.0;
+}
+
+void writeRow(ofstream& f, const string& type, const string& name, const RouteStats& rs, double wallSec) {
+    const Histogram& h = rs.latency;
+    uint64_t count = h.count();
+    f << type << "," << name << "," << count << "," << rs.failures << "," << ms(h.percentile(0.5)) << ","
+      << h.mean() / 1000 << "," << ms(h.min()) << "," << ms(h.max()) << ","
+      << (count ? (double)rs.bodyBytes / count : 0) << "," << count / wallSec << "," << rs.failures / wallSec;
+    for (double p : {0.5, 0.66, 0.75, 0.8, 0.9, 0.95, 0.98, 0.99, 0.999, 0.9999, 1.0})
+        f << "," << ms(h.percentile(p));
+    f << "\n";
+}
+
+// Times are in milliseconds like Locust's, but with microsecond resolution
+// instead of being rounded, since a native client sees sub-millisecond ones.
+void writeCsv(const string& path, const Stats& stats, double wallSec) {
+    ofstream f(path);
+    f.precision(10);
+    f << "Type,Name,Request Count,Failure Count,Median Response Time,Average Response Time,"
+         "Min Response Time,Max Response Time,Average Content Size,Requests/s,Failures/s,"
+         "50%,66%,75%,80%,90%,95%,98%,99%,99.9%,99.99%,100%\n";
+    RouteStats all;
+    for (size_t r = 0; r < ROUTES.size(); r++) {
+        writeRow(f, "GET", ROUTES[r].path, stats[r], wallSec);
+        all.merge(stats[r]);
+    }
+    writeRow(f, "", "Aggregated", all, wallSec);
+}
+
+void print(const Stats& stats, double wallSec) {
+    cout << left << setw(20) << "Name" << setw(10) << "Count" << setw(8) << "Fail" << setw(12) << "p50 (ms)"
+         << setw(12) << "p99 (ms)" << setw(12) << "p99.9 (ms)" << setw(12) << "max (ms)" << "req/s\n";
+    cout << string(94, '-') << "\n";
+    RouteStats all;
+    auto row = [&](const string& name, const RouteStats& rs) {
+        const Histogram& h = rs.latency;
+        cout << left << setw(20) << name << setw(10) << h.count() << setw(8) << rs.failures << fixed
+             << setprecision(3) << setw(12) << ms(h.percentile(0.5)) << setw(12) << ms(h.percentile(0.99))
+             << setw(12) << ms(h.percentile(0.999)) << setw(12) << ms(h.max()) << setprecision(1)
+             << h.count() / wallSec << "\n";
+    };
+    for (size_t r = 0; r < ROUTES.size(); r++) {
+        row(ROUTES[r].path, stats[r]);
+        all.merge(stats[r]);
+    }
+    row("Aggregated", all);
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) return 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(o.port);
+    if (inet_pton(AF_INET, o.host.c_str(), &addr.sin_addr) != 1) {
+        cerr << "[loadgen] bad IPv4 address " << o.host << "\n";
+        return 1;
+    }
+
+    cout << "[loadgen] " << o.rate << " req/s for " << o.seconds << " s over " << o.connections
+         << " connections, " << o.threads << " threads, pipeline " << o.pipeline
+         << (o.keepAlive ? "" : ", no keep-alive") << " against " << o.host << ":" << o.port << "\n";
+
+    auto start = steady_clock::now() + milliseconds(10);
+    auto end = start + duration_cast<nanoseconds>(duration<double>(o.seconds));
+    vector<unique_ptr<Worker>> workers;
+    for (int t = 0, first = 0; t < o.threads; t++) {
+        int count = o.connections / o.threads + (t < o.connections % o.threads ? 1 : 0);
+        workers.push_back(make_unique<Worker>(o, addr, first, count, start, (unsigned)(t * 100003 + 1)));
+        first += count;
+    }
+    vector<thread> threads;
+    for (auto& w : workers) threads.emplace_back(&Worker::run, w.get(), end);
+    for (auto& t : threads) t.join();
+    double wallSec = duration<double>(steady_clock::now() - start).count();
+
+    Stats stats;
+    for (auto& w : workers)
+        for (size_t r = 0; r < ROUTES.size(); r++) stats[r].merge(w->stats()[r]);
+    print(stats, wallSec);
+
+    uint64_t done = 0;
+    for (const RouteStats& rs : stats) done += rs.latency.count();
+    double achieved = done / wallSec;
+    string path = o.csvPrefix + "_stats.csv";
+    writeCsv(path, stats, wallSec);
+    cout << "\n[loadgen] " << fixed << setprecision(1) << achieved << " req/s achieved of " << o.rate
+         << " requested, stats in " << path << "\n";
+    if (achieved < o.rate * 0.95)
+        cout << "[loadgen] the server fell behind the schedule; latencies include the time requests "
+                "spent waiting to be sent\n";
+    return 0;
+}
@@ -3,14 +3,54 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <list>
+#include <deque>
+#include <string_view>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <mutex>
+#include <filesystem>
+#include <csignal>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "uring.h"
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
 
 using namespace std;
+using namespace chrono;
 
 constexpr int PORT = 8080;
 constexpr char ROOT_DIR[] = "static";
+constexpr size_t MAX_REQUEST = 8192;
+constexpr size_t MAX_PENDING_OUT = 256 * 1024;
+constexpr size_t MAX_BUFFERED_IN = 64 * 1024;
+constexpr int MAX_KEEPALIVE_REQUESTS = 1000;
+constexpr seconds IDLE_TIMEOUT{5};
+constexpr size_t SENDFILE_THRESHOLD = 256 * 1024;
+constexpr seconds CACHE_MAX_AGE{60};
 
 string readFile(const string& p){
     ifstream f(p, ios::binary);
@@ -18,6 +58,50 @@ string readFile(const string& p){
     ostringstream s;s<<f.rdbuf();return s.str();
 }
 
+int hexValue(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+// Normalises a request target into a path under ROOT_DIR: drops the query,
+// percent-decodes, skips "." and empty segments and maps directories to
+// index.html. Targets with ".." segments are refused instead of resolved, so
+// nothing outside ROOT_DIR can be named.
+bool resolveTarget(string_view target, string& path) {
+    target = target.substr(0, target.find_first_of("?#"));
+    if (target.empty() || target[0] != '/') return false;
+    string decoded;
+    for (size_t i = 0; i < target.size(); i++) {
+        char ch = target[i];
+        if (ch == '%') {
+            int hi = i + 2 < target.size() ? hexValue(target[i + 1]) : -1;
+            int lo = hi >= 0 ? hexValue(target[i + 2]) : -1;
+            if (lo < 0) return false;
+            ch = (char)(hi * 16 + lo);
+            i += 2;
+        }
+        if (ch == '\0') return false;
+        decoded += ch;
+    }
+    path.clear();
+    size_t pos = 0;
+    while (pos < decoded.size()) {
+        size_t next = decoded.find('/', pos);
+        if (next == string::npos) next = decoded.size();
+        string_view seg(decoded.data() + pos, next - pos);
+        if (seg == "..") return false;
+        if (!seg.empty() && seg != ".") {
+            path += '/';
+            path += seg;
+        }
+        pos = next + 1;
+    }
+    if (path.empty() || decoded.back() == '/') path += "/index.html";
+    return true;
+}
+
 void sendResp(int c,string st,string b){
     ostringstream r;
     r<<"HTTP/1.1 "<<st<<"\r\nContent-Length:"<<b.size()
@@ -36,7 +120,11 @@ void handleClient(int c){
     istringstream ss(buf);
     ss>>m>>p>>v;
 
-    if(p=="/")p="/index.html";
+    if(!resolveTarget(p,p)){
+        sendResp(c,"400 Bad Request","");
+        close(c);
+        return;
+    }
 
     string fp=string(ROOT_DIR)+p;
     string data=readFile(fp);
@@ -47,28 +135,1659 @@ void handleClient(int c){
     close(c);
 }
 
-int main(){
-    int s=socket(AF_INET,SOCK_STREAM,0);
+void runThreaded(int s){
+    while(true){
+        int c=::accept(s,nullptr,nullptr);
+        if(c<0){perror("accept");continue;}
+        thread(handleClient,c).detach();
+    }
+}
+
+int openListener(bool reusePort) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reusePort)
+        setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 
     sockaddr_in a{};
-    a.sin_family=AF_INET;
-    a.sin_addr.s_addr=INADDR_ANY;
-    a.sin_port=htons(PORT);
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = INADDR_ANY;
+    a.sin_port = htons(PORT);
 
-    if(::bind(s,(sockaddr*)&a,sizeof(a))<0){
+    if (::bind(s, (sockaddr*)&a, sizeof(a)) < 0) {
         perror("bind");
-        return 1;
+        close(s);
+        return -1;
     }
-    if(::listen(s,128)<0){
+    if (::listen(s, SOMAXCONN) < 0) {
         perror("listen");
-        return 1;
+        close(s);
+        return -1;
     }
+    return s;
+}
 
-    cout<<"RUN http://localhost:"<<PORT<<endl;
+enum : uint8_t { ACCEPT_GZIP = 1, ACCEPT_BR = 2 };
 
-    while(true){
-        int c=::accept(s,nullptr,nullptr);
-        if(c<0){perror("accept");continue;}
-        thread(handleClient,c).detach();
+struct HttpRequest {
+    string_view method;
+    string_view target;
+    int minor = 1;
+    bool keepAlive = true;
+    size_t contentLength = 0;
+    uint8_t encodings = 0;  // ACCEPT_* bits
+    string_view ifNoneMatch;
+    string_view ifModifiedSince;
+    string_view range;
+    string_view ifRange;
+};
+
+enum class ParseStatus { Incomplete, Done, Bad };
+
+bool equalsNoCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    return true;
+}
+
+string_view trim(string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+bool containsToken(string_view list, string_view token) {
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        if (equalsNoCase(trim(list.substr(0, comma)), token)) return true;
+        if (comma == string_view::npos) break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Returns the ACCEPT_* codings the client takes. A coding with q=0 is refused
+// and "*" stands for every coding that is not listed by name.
+uint8_t parseAcceptEncoding(string_view list) {
+    uint8_t listed = 0, accepted = 0;
+    bool star = false;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        string_view item = list.substr(0, comma);
+        list = comma == string_view::npos ? string_view{} : list.substr(comma + 1);
+        size_t semi = item.find(';');
+        string_view coding = trim(item.substr(0, semi));
+        bool refused = false;
+        if (semi != string_view::npos) {
+            string_view param = trim(item.substr(semi + 1));
+            if (param.size() > 2 && tolower((unsigned char)param[0]) == 'q' && param[1] == '=')
+                refused = param.substr(2).find_first_not_of("0.") == string_view::npos;
+        }
+        if (coding == "*") {
+            star = !refused;
+            continue;
+        }
+        uint8_t bit = equalsNoCase(coding, "gzip") || equalsNoCase(coding, "x-gzip") ? ACCEPT_GZIP
+                      : equalsNoCase(coding, "br")                                   ? ACCEPT_BR
+                                                                                     : 0;
+        listed |= bit;
+        if (!refused) accepted |= bit;
+    }
+    if (star) accepted |= (ACCEPT_GZIP | ACCEPT_BR) & ~listed;
+    return accepted;
+}
+
+// Incremental request parser. `scanned` carries how far a previous call got
+// looking for the end of the head, so a request split across many reads is
+// not rescanned from the start every time. On Done, `consumed` covers the head
+// and any body announced by Content-Length; the views in `req` point into
+// `data` and stay valid until the caller drops those bytes.
+ParseStatus parseRequest(string_view data, size_t& scanned, HttpRequest& req, size_t& consumed) {
+    size_t from = scanned > 3 ? scanned - 3 : 0;
+    size_t end = data.find("\r\n\r\n", from);
+    if (end == string_view::npos) {
+        scanned = data.size();
+        return data.size() > MAX_REQUEST ? ParseStatus::Bad : ParseStatus::Incomplete;
+    }
+    if (end > MAX_REQUEST) return ParseStatus::Bad;
+    string_view head = data.substr(0, end);
+    size_t lineEnd = head.find("\r\n");
+    string_view line = head.substr(0, lineEnd);
+
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.rfind(' ');
+    if (sp1 == string_view::npos || sp2 == sp1) return ParseStatus::Bad;
+    req = HttpRequest{};
+    req.method = line.substr(0, sp1);
+    req.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    string_view version = line.substr(sp2 + 1);
+    if (version == "HTTP/1.1") req.minor = 1;
+    else if (version == "HTTP/1.0") req.minor = 0;
+    else return ParseStatus::Bad;
+    req.keepAlive = req.minor == 1;
+
+    string_view rest = lineEnd == string_view::npos ? string_view{} : head.substr(lineEnd + 2);
+    while (!rest.empty()) {
+        size_t eol = rest.find("\r\n");
+        string_view h = rest.substr(0, eol);
+        rest = eol == string_view::npos ? string_view{} : rest.substr(eol + 2);
+        size_t colon = h.find(':');
+        if (colon == string_view::npos) return ParseStatus::Bad;
+        string_view name = h.substr(0, colon);
+        string_view value = trim(h.substr(colon + 1));
+        if (equalsNoCase(name, "Connection")) {
+            if (containsToken(value, "close")) req.keepAlive = false;
+            else if (containsToken(value, "keep-alive")) req.keepAlive = true;
+        } else if (equalsNoCase(name, "Content-Length")) {
+            size_t len = 0;
+            for (char ch : value) {
+                if (ch < '0' || ch > '9') return ParseStatus::Bad;
+                len = len * 10 + (ch - '0');
+                if (len > MAX_REQUEST) return ParseStatus::Bad;
+            }
+            req.contentLength = len;
+        } else if (equalsNoCase(name, "Accept-Encoding")) {
+            req.encodings = parseAcceptEncoding(value);
+        } else if (equalsNoCase(name, "If-None-Match")) {
+            req.ifNoneMatch = value;
+        } else if (equalsNoCase(name, "If-Modified-Since")) {
+            req.ifModifiedSince = value;
+        } else if (equalsNoCase(name, "Range")) {
+            req.range = value;
+        } else if (equalsNoCase(name, "If-Range")) {
+            req.ifRange = value;
+        } else if (equalsNoCase(name, "Transfer-Encoding")) {
+            return ParseStatus::Bad;
+        }
+    }
+    scanned = end;
+    consumed = end + 4 + req.contentLength;
+    return data.size() < consumed ? ParseStatus::Incomplete : ParseStatus::Done;
+}
+
+#ifdef __linux__
+const char* contentType(string_view path) {
+    static const pair<const char*, const char*> types[] = {
+        {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".js", "application/javascript"}, {".json", "application/json"},
+        {".txt", "text/plain"}, {".svg", "image/svg+xml"}, {".png", "image/png"},
+        {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+        {".ico", "image/x-icon"},
+    };
+    size_t dot = path.rfind('.');
+    if (dot != string_view::npos)
+        for (auto& [ext, type] : types)
+            if (path.substr(dot) == ext) return type;
+    return "application/octet-stream";
+}
+
+bool isCompressible(string_view type) {
+    return type.substr(0, 5) == "text/" || type == "application/javascript" || type == "application/json" ||
+           type == "image/svg+xml";
+}
+
+#ifdef HAVE_ZLIB
+string gzipCompress(const string& in) {
+    z_stream zs{};
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return "";
+    string out(deflateBound(&zs, in.size()), '\0');
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = (uInt)in.size();
+    zs.next_out = (Bytef*)out.data();
+    zs.avail_out = (uInt)out.size();
+    int r = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return r == Z_STREAM_END ? out : "";
+}
+#endif
+
+#ifdef HAVE_BROTLI
+string brotliCompress(const string& in) {
+    size_t size = BrotliEncoderMaxCompressedSize(in.size());
+    string out(size, '\0');
+    if (!size || !BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(),
+                                        (const uint8_t*)in.data(), &size, (uint8_t*)out.data()))
+        return "";
+    out.resize(size);
+    return out;
+}
+#endif
+
+// Server metrics. Every event loop owns a WorkerStats block and is its only
+// writer, so counters are bumped with a relaxed load and store rather than a
+// locked read-modify-write, and no two loops share a cache line. /_stats sums
+// the blocks when asked; it may read a count a few requests old but never a
+// torn one. Requests are counted per route and status with the time from
+// parsing to the last byte handed to the kernel, in Prometheus-style buckets.
+constexpr size_t MAX_ROUTES = 64;
+enum : uint16_t { ROUTE_OTHER, ROUTE_STATS, ROUTE_NOT_FOUND };  // files follow, up to MAX_ROUTES
+constexpr array<int, 8> STATUSES = {200, 206, 304, 400, 404, 405, 416, 0};  // 0: any other
+constexpr array<uint64_t, 15> LATENCY_BOUNDS_NS = {100000,    250000,    500000,    1000000,   2500000,
+                                                   5000000,   10000000,  25000000,  50000000,  100000000,
+                                                   250000000, 500000000, 1000000000, 2500000000, 5000000000};
+
+void bump(atomic<uint64_t>& a, uint64_t n = 1) {
+    a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+int metricIndex(uint16_t route, int status) {
+    size_t s = 0;
+    while (s + 1 < STATUSES.size() && STATUSES[s] != status) s++;
+    return (int)(route * STATUSES.size() + s);
+}
+
+struct LatencyCell {
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> sumNs{0};
+    array<atomic<uint64_t>, LATENCY_BOUNDS_NS.size() + 1> buckets{};
+};
+
+struct alignas(64) WorkerStats {
+    atomic<uint64_t> accepted{0};
+    atomic<uint64_t> closed{0};
+    atomic<uint64_t> acceptErrors{0};
+    atomic<uint64_t> bytesSent{0};
+    atomic<uint64_t> cacheHits{0};
+    atomic<uint64_t> cacheMisses{0};
+    array<LatencyCell, MAX_ROUTES * STATUSES.size()> cells;
+
+    void record(int metric, nanoseconds took) {
+        LatencyCell& cell = cells[metric];
+        uint64_t ns = took.count();
+        size_t b = 0;
+        while (b < LATENCY_BOUNDS_NS.size() && ns > LATENCY_BOUNDS_NS[b]) b++;
+        bump(cell.count);
+        bump(cell.sumNs, ns);
+        bump(cell.buckets[b]);
+    }
+};
+
+// The calling event loop's block; null on threads that serve no HTTP.
+thread_local WorkerStats* t_stats = nullptr;
+
+class Metrics {
+public:
+    Metrics() : m_routes{"other", "/_stats", "(not found)"} {}
+
+    WorkerStats& addWorker() {
+        lock_guard<mutex> lock(m_mutex);
+        m_workers.push_back(make_unique<WorkerStats>());
+        return *m_workers.back();
+    }
+
+    // Routes are handed out to files as they are first loaded; once the table
+    // is full, further files are counted under "other".
+    uint16_t route(string_view key) {
+        lock_guard<mutex> lock(m_mutex);
+        for (size_t i = ROUTE_NOT_FOUND + 1; i < m_routes.size(); i++)
+            if (m_routes[i] == key) return (uint16_t)i;
+        if (m_routes.size() == MAX_ROUTES) return ROUTE_OTHER;
+        string name(key);
+        for (char& ch : name)
+            if ((unsigned char)ch < 0x20 || ch == '"' || ch == '\\') ch = '_';
+        m_routes.push_back(move(name));
+        return (uint16_t)(m_routes.size() - 1);
+    }
+
+    string prometheus() {
+        Totals t = collect();
+        ostringstream out;
+        auto metric = [&](const char* name, const char* kind, const char* help, auto value) {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << kind << "\n"
+                << name << " " << value << "\n";
+        };
+        metric("lab5_connections_open", "gauge", "Connections currently open.", t.accepted - t.closed);
+        metric("lab5_connections_accepted_total", "counter", "Connections accepted.", t.accepted);
+        metric("lab5_accept_errors_total", "counter", "Failed accept calls.", t.acceptErrors);
+        metric("lab5_bytes_sent_total", "counter", "Response bytes written to sockets.", t.bytesSent);
+        metric("lab5_cache_hits_total", "counter", "File cache lookups served from memory.", t.cacheHits);
+        metric("lab5_cache_misses_total", "counter", "File cache lookups that loaded from disk.", t.cacheMisses);
+        metric("lab5_cache_hit_ratio", "gauge", "Share of file cache lookups that hit.", t.hitRatio());
+        out << "# HELP lab5_request_duration_seconds Time from parsing a request to writing its response.\n"
+               "# TYPE lab5_request_duration_seconds histogram\n";
+        forEachCell(t, [&](const string& labels, const uint64_t* c) {
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b <= LATENCY_BOUNDS_NS.size(); b++) {
+                cumulative += c[2 + b];
+                out << "lab5_request_duration_seconds_bucket{" << labels << ",le=\"" << bound(b) << "\"} "
+                    << cumulative << "\n";
+            }
+            out << "lab5_request_duration_seconds_sum{" << labels << "} " << c[1] / 1e9 << "\n"
+                << "lab5_request_duration_seconds_count{" << labels << "} " << c[0] << "\n";
+        });
+        return out.str();
+    }
+
+    string json() {
+        Totals t = collect();
+        ostringstream out;
+        out << "{\"connections\":{\"open\":" << t.accepted - t.closed << ",\"accepted\":" << t.accepted
+            << ",\"accept_errors\":" << t.acceptErrors << "},\"bytes_sent\":" << t.bytesSent
+            << ",\"cache\":{\"hits\":" << t.cacheHits << ",\"misses\":" << t.cacheMisses
+            << ",\"hit_ratio\":" << t.hitRatio() << "},\"requests\":[";
+        bool first = true;
+        forEachCell(t, [&](const string&, const uint64_t* c, const string& route, int status) {
+            out << (first ? "" : ",") << "{\"route\":\"" << route << "\",\"status\":";
+            if (status) out << status;
+            else out << "\"other\"";
+            out << ",\"count\":" << c[0] << ",\"sum_seconds\":" << c[1] / 1e9 << ",\"buckets\":{";
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b <= LATENCY_BOUNDS_NS.size(); b++) {
+                cumulative += c[2 + b];
+                out << (b ? "," : "") << "\"" << bound(b) << "\":" << cumulative;
+            }
+            out << "}}";
+            first = false;
+        });
+        out << "]}\n";
+        return out.str();
+    }
+
+private:
+    static constexpr size_t CELL_WORDS = 2 + LATENCY_BOUNDS_NS.size() + 1;  // count, sum, buckets
+
+    struct Totals {
+        uint64_t accepted = 0, closed = 0, acceptErrors = 0, bytesSent = 0, cacheHits = 0, cacheMisses = 0;
+        vector<uint64_t> cells;
+        vector<string> routes;
+
+        double hitRatio() const {
+            uint64_t lookups = cacheHits + cacheMisses;
+            return lookups ? (double)cacheHits / lookups : 0;
+        }
+    };
+
+    static string bound(size_t b) {
+        if (b == LATENCY_BOUNDS_NS.size()) return "+Inf";
+        ostringstream s;
+        s << LATENCY_BOUNDS_NS[b] / 1e9;
+        return s.str();
+    }
+
+    // Calls `f` for every route and status that has served requests, either
+    // with its Prometheus labels or, for JSON, with the route and status too.
+    template <class F>
+    static void forEachCell(const Totals& t, F&& f) {
+        for (size_t route = 0; route < t.routes.size(); route++)
+            for (size_t s = 0; s < STATUSES.size(); s++) {
+                const uint64_t* c = &t.cells[(route * STATUSES.size() + s) * CELL_WORDS];
+                if (!c[0]) continue;
+                string status = STATUSES[s] ? to_string(STATUSES[s]) : "other";
+                string labels = "route=\"" + t.routes[route] + "\",status=\"" + status + "\"";
+                if constexpr (is_invocable_v<F, const string&, const uint64_t*>) f(labels, c);
+                else f(labels, c, t.routes[route], STATUSES[s]);
+            }
+    }
+
+    Totals collect() {
+        Totals t;
+        t.cells.assign(MAX_ROUTES * STATUSES.size() * CELL_WORDS, 0);
+        lock_guard<mutex> lock(m_mutex);
+        t.routes = m_routes;
+        auto get = [](const atomic<uint64_t>& a) { return a.load(memory_order_relaxed); };
+        for (auto& w : m_workers) {
+            t.accepted += get(w->accepted);
+            t.closed += get(w->closed);
+            t.acceptErrors += get(w->acceptErrors);
+            t.bytesSent += get(w->bytesSent);
+            t.cacheHits += get(w->cacheHits);
+            t.cacheMisses += get(w->cacheMisses);
+            for (size_t i = 0; i < w->cells.size(); i++) {
+                const LatencyCell& cell = w->cells[i];
+                uint64_t* c = &t.cells[i * CELL_WORDS];
+                c[0] += get(cell.count);
+                c[1] += get(cell.sumNs);
+                for (size_t b = 0; b < cell.buckets.size(); b++) c[2 + b] += get(cell.buckets[b]);
+            }
+        }
+        return t;
+    }
+
+    mutex m_mutex;
+    vector<string> m_routes;
+    vector<unique_ptr<WorkerStats>> m_workers;
+};
+
+Metrics g_metrics;
+
+// A complete response kept ready to go out: the header block in both
+// Connection flavours plus the body, written together with writev. Files of
+// SENDFILE_THRESHOLD bytes or more keep an open descriptor instead of a body
+// and are sent with sendfile, using explicit offsets so one descriptor can
+// serve any number of connections at once. Compressible files carry their
+// gzip and brotli variants, when those are smaller, as responses of their own.
+// File responses also keep their validators and a ready 304; `meta` holds the
+// header lines that 200, 206 and 304 share.
+struct CachedResponse {
+    string key;
+    string keepAliveHead;
+    string closeHead;
+    string body;
+    int fd = -1;
+    size_t fileSize = 0;
+    int64_t mtimeNs = 0;
+    const char* type = "";
+    string meta;
+    string etag;
+    time_t modified = 0;
+    uint16_t route = ROUTE_OTHER;
+    uint16_t status = 0;
+    shared_ptr<const CachedResponse> notModified;
+    shared_ptr<const CachedResponse> gzip;
+    shared_ptr<const CachedResponse> br;
+
+    ~CachedResponse() {
+        if (fd >= 0) close(fd);
+    }
+
+    size_t length() const { return fd >= 0 ? fileSize : body.size(); }
+
+    size_t bytes() const {
+        return key.size() + keepAliveHead.size() + closeHead.size() + body.size() + meta.size() + etag.size() +
+               (notModified ? notModified->bytes() : 0) + (gzip ? gzip->bytes() : 0) + (br ? br->bytes() : 0);
+    }
+};
+
+// `lines` is the status line plus header lines, each ending in CRLF.
+void setHeads(CachedResponse& r, const string& lines) {
+    r.keepAliveHead = lines + "Connection: keep-alive\r\n\r\n";
+    r.closeHead = lines + "Connection: close\r\n\r\n";
+}
+
+// `extra` holds any further header lines, each ending in CRLF.
+shared_ptr<CachedResponse> makeHead(string key, const string& status, const char* type, size_t length,
+                                    const string& extra = "") {
+    auto r = make_shared<CachedResponse>();
+    setHeads(*r, "HTTP/1.1 " + status + "\r\nContent-Type: " + type + "\r\nContent-Length: " + to_string(length) +
+                     "\r\n" + extra);
+    r->key = move(key);
+    r->type = type;
+    r->meta = extra;
+    r->status = (uint16_t)atoi(status.c_str());
+    return r;
+}
+
+shared_ptr<CachedResponse> makeResponse(string key, const string& status, const char* type, string body,
+                                        const string& extra = "") {
+    auto r = makeHead(move(key), status, type, body.size(), extra);
+    r->body = move(body);
+    return r;
+}
+
+string httpDate(time_t t) {
+    tm g{};
+    gmtime_r(&t, &g);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &g);
+    return buf;
+}
+
+// Only the IMF-fixdate form; anything else counts as no date at all.
+bool parseHttpDate(string_view s, time_t& t) {
+    char buf[64];
+    if (s.size() >= sizeof(buf)) return false;
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = 0;
+    tm g{};
+    const char* end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &g);
+    if (!end || *end) return false;
+    t = timegm(&g);
+    return true;
+}
+
+// Turns `r` into a conditional-capable 200: ETag, Last-Modified,
+// Cache-Control and Accept-Ranges go in front of `extra`, and the matching
+// 304 is built once next to it.
+void addValidators(CachedResponse& r, string etag, time_t modified, const string& extra) {
+    r.meta = "ETag: " + etag + "\r\nLast-Modified: " + httpDate(modified) +
+             "\r\nCache-Control: public, max-age=" + to_string(CACHE_MAX_AGE.count()) +
+             "\r\nAccept-Ranges: bytes\r\n" + extra;
+    setHeads(r, "HTTP/1.1 200 OK\r\nContent-Type: " + string(r.type) + "\r\nContent-Length: " +
+                    to_string(r.length()) + "\r\n" + r.meta);
+    auto nm = make_shared<CachedResponse>();
+    setHeads(*nm, "HTTP/1.1 304 Not Modified\r\n" + r.meta);
+    nm->route = r.route;
+    nm->status = 304;
+    r.notModified = move(nm);
+    r.etag = move(etag);
+    r.modified = modified;
+}
+
+const shared_ptr<const CachedResponse> g_badRequest = makeResponse("", "400 Bad Request", "text/plain", "");
+const shared_ptr<const CachedResponse> g_methodNotAllowed = makeResponse("", "405 Method Not Allowed", "text/plain", "");
+
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(string_view s) const { return hash<string_view>{}(s); }
+};
+
+// Responses for files under ROOT_DIR, 404s included, keyed by normalised URL
+// path. Sharded like lab4's session registry so event loops rarely contend;
+// every shard has its own LRU list and slice of the byte budget. Lookups take
+// a string_view and hits copy a shared_ptr, so serving a cached file does not
+// allocate. A response being written survives its own eviction.
+class FileCache {
+public:
+    void configure(size_t budget) { m_shardBudget = budget / SHARDS; }
+
+    shared_ptr<const CachedResponse> get(string_view key) {
+        Shard& sh = shard(key);
+        uint64_t generation;
+        {
+            lock_guard<mutex> lock(sh.m);
+            auto it = sh.entries.find(key);
+            if (it != sh.entries.end()) {
+                sh.lru.splice(sh.lru.begin(), sh.lru, it->second.lruPos);
+                if (t_stats) bump(t_stats->cacheHits);
+                return it->second.response;
+            }
+            generation = sh.generation;
+        }
+        if (t_stats) bump(t_stats->cacheMisses);
+        shared_ptr<const CachedResponse> response = load(string(key));
+        lock_guard<mutex> lock(sh.m);
+        // An invalidation that raced with the load may have made it stale.
+        if (sh.generation != generation || response->bytes() > m_shardBudget) return response;
+        auto [it, inserted] = sh.entries.try_emplace(response->key);
+        if (!inserted) {
+            sh.lru.splice(sh.lru.begin(), sh.lru, it->second.lruPos);
+            return it->second.response;
+        }
+        it->second.response = response;
+        it->second.lruPos = sh.lru.insert(sh.lru.begin(), &it->first);
+        sh.bytes += response->bytes();
+        while (sh.bytes > m_shardBudget) {
+            auto victim = sh.entries.find(*sh.lru.back());
+            sh.bytes -= victim->second.response->bytes();
+            sh.lru.pop_back();
+            sh.entries.erase(victim);
+        }
+        return response;
+    }
+
+    void invalidate(string_view key) {
+        Shard& sh = shard(key);
+        lock_guard<mutex> lock(sh.m);
+        sh.generation++;
+        auto it = sh.entries.find(key);
+        if (it == sh.entries.end()) return;
+        sh.bytes -= it->second.response->bytes();
+        sh.lru.erase(it->second.lruPos);
+        sh.entries.erase(it);
+    }
+
+    void clear() {
+        for (Shard& sh : m_shards) {
+            lock_guard<mutex> lock(sh.m);
+            sh.generation++;
+            sh.entries.clear();
+            sh.lru.clear();
+            sh.bytes = 0;
+        }
+    }
+
+    // Watches ROOT_DIR and its subdirectories with inotify and drops entries
+    // whose file changes. Directory-level changes clear everything, which
+    // also covers 404s cached below a directory that appears later.
+    bool watch() {
+        m_inotify = inotify_init1(IN_CLOEXEC);
+        if (m_inotify < 0) return false;
+        addWatches("");
+        thread(&FileCache::watchLoop, this).detach();
+        return true;
+    }
+
+private:
+    static constexpr size_t SHARDS = 16;
+    static constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                           IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    struct Entry {
+        shared_ptr<const CachedResponse> response;
+        list<const string*>::iterator lruPos;
+    };
+
+    struct Shard {
+        mutex m;
+        unordered_map<string, Entry, StringHash, equal_to<>> entries;
+        list<const string*> lru;  // front is the most recently used
+        size_t bytes = 0;
+        uint64_t generation = 0;
+    };
+
+    Shard& shard(string_view key) { return m_shards[StringHash{}(key) % SHARDS]; }
+
+    static shared_ptr<const CachedResponse> load(string key) {
+        string path = ROOT_DIR + key;
+        const char* type = contentType(key);
+        bool compressible = isCompressible(type);
+        auto r = loadFile(key, path, type, compressible ? "Vary: Accept-Encoding\r\n" : "");
+        if (!r) {
+            auto missing = makeResponse(move(key), "404 Not Found", "text/html", "<h1>404 Not Found</h1>");
+            missing->route = ROUTE_NOT_FOUND;
+            return missing;
+        }
+        if (compressible) {
+            r->gzip = loadVariant(*r, path + ".gz", type, "gzip");
+            r->br = loadVariant(*r, path + ".br", type, "br");
+        }
+        return r;
+    }
+
+    // Reads a regular file into a response, or opens it for sendfile when it
+    // is large. Returns null when there is no such file. Keyless variants
+    // are counted under the route of the file they encode.
+    static shared_ptr<CachedResponse> loadFile(string key, const string& path, const char* type,
+                                               const string& extra, uint16_t route = ROUTE_OTHER) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            return nullptr;
+        }
+        if (!key.empty()) route = g_metrics.route(key);
+        shared_ptr<CachedResponse> r;
+        if ((size_t)st.st_size >= SENDFILE_THRESHOLD) {
+            r = makeHead(move(key), "200 OK", type, st.st_size, extra);
+            r->fd = fd;
+            r->fileSize = st.st_size;
+        } else {
+            string body(st.st_size, '\0');
+            size_t got = 0;
+            while (got < body.size()) {
+                ssize_t n = read(fd, body.data() + got, body.size() - got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                got += n;
+            }
+            body.resize(got);
+            close(fd);
+            r = makeResponse(move(key), "200 OK", type, move(body), extra);
+        }
+        r->mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        r->route = route;
+        // Size and modification time in nanoseconds change with any rewrite,
+        // which is what a strong validator needs, and cost no hashing.
+        char etag[64];
+        snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long)st.st_size,
+                 (unsigned long long)r->mtimeNs);
+        addValidators(*r, etag, st.st_mtime, extra);
+        return r;
+    }
+
+    // A precompressed sibling on disk wins unless it is older than the file
+    // itself; otherwise small files are compressed here, once per load. A
+    // variant that does not shrink the body is not worth a Vary round.
+    static shared_ptr<const CachedResponse> loadVariant(const CachedResponse& plain, const string& path,
+                                                        const char* type, const string& coding) {
+        string extra = "Content-Encoding: " + coding + "\r\nVary: Accept-Encoding\r\n";
+        shared_ptr<CachedResponse> v = loadFile("", path, type, extra, plain.route);
+        if (v && v->mtimeNs < plain.mtimeNs) v.reset();
+        if (!v && plain.fd < 0) {
+            string packed;
+#ifdef HAVE_ZLIB
+            if (coding == "gzip") packed = gzipCompress(plain.body);
+#endif
+#ifdef HAVE_BROTLI
+            if (coding == "br") packed = brotliCompress(plain.body);
+#endif
+            if (!packed.empty()) {
+                v = makeResponse("", "200 OK", type, move(packed));
+                v->route = plain.route;
+                string etag = plain.etag;
+                etag.insert(etag.size() - 1, "-" + coding);
+                addValidators(*v, etag, plain.modified, extra);
+            }
+        }
+        if (!v || v->length() >= plain.length()) return nullptr;
+        return v;
+    }
+
+    void addWatches(const string& prefix) {
+        string dir = ROOT_DIR + prefix;
+        int wd = inotify_add_watch(m_inotify, dir.c_str(), WATCH_MASK);
+        if (wd < 0) return;
+        m_watches[wd] = prefix;
+        error_code ec;
+        for (auto& e : filesystem::directory_iterator(dir, ec))
+            if (e.is_directory(ec)) addWatches(prefix + "/" + e.path().filename().string());
+    }
+
+    void watchLoop() {
+        alignas(inotify_event) char buf[16384];
+        while (true) {
+            ssize_t n = read(m_inotify, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            for (char* p = buf; p < buf + n;) {
+                auto* ev = (inotify_event*)p;
+                p += sizeof(inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    clear();
+                    continue;
+                }
+                auto it = m_watches.find(ev->wd);
+                if (it == m_watches.end()) continue;
+                if (ev->mask & IN_IGNORED) {
+                    m_watches.erase(it);
+                    continue;
+                }
+                string key = it->second + "/" + (ev->len ? ev->name : "");
+                if (ev->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                        addWatches(key);
+                    clear();
+                } else if (ev->len) {
+                    invalidate(key);
+                    // A precompressed sibling belongs to the file it shadows.
+                    for (string_view ext : {".gz", ".br"})
+                        if (key.size() > ext.size() && key.compare(key.size() - ext.size(), ext.size(), ext) == 0)
+                            invalidate(string_view(key).substr(0, key.size() - ext.size()));
+                }
+            }
+        }
+    }
+
+    array<Shard, SHARDS> m_shards;
+    size_t m_shardBudget = 0;
+    int m_inotify = -1;
+    unordered_map<int, string> m_watches;  // owned by the watcher thread
+};
+
+FileCache g_files;
+
+// Targets that are already in resolveTarget's normal form can be used as
+// cache keys directly, without building a new string.
+bool isCanonical(string_view t) {
+    return t.size() > 1 && t[0] == '/' && t.back() != '/' && t.find_first_of("%?#") == string_view::npos &&
+           t.find("/.") == string_view::npos && t.find("//") == string_view::npos;
+}
+
+// Queued output points into cached responses; the shared_ptr keeps the bytes
+// alive until they are written. A null `data` marks a file body that starts
+// `fileOff` bytes into the file. The last segment of every response carries
+// its metrics cell and the time its request was parsed.
+struct OutSegment {
+    shared_ptr<const CachedResponse> response;
+    const char* data;
+    size_t len;
+    size_t fileOff = 0;
+    int metric = -1;
+    steady_clock::time_point parsed{};
+};
+
+// Per-connection HTTP state shared by the epoll and io_uring engines.
+struct HttpConn {
+    int fd = -1;
+    string in;
+    size_t scanned = 0;
+    vector<OutSegment> out;
+    size_t outHead = 0;
+    size_t outOff = 0;
+    size_t pending = 0;
+    int served = 0;
+    bool corked = false;
+    bool closing = false;
+    bool eof = false;
+    bool readPaused = false;
+    steady_clock::time_point lastActive;
+    list<uint64_t>::iterator idlePos;
+};
+
+// Output is stalled and a batch of input is already waiting behind it, so
+// reading more would only grow `in`. The engines then leave input in the
+// kernel, where the TCP window pushes back on a client that pipelines
+// without reading, until the output drains. A closing connection discards
+// its input and is never stalled.
+bool inputStalled(const HttpConn& c) {
+    return !c.closing && c.pending >= MAX_PENDING_OUT && c.in.size() >= MAX_BUFFERED_IN;
+}
+
+// close() with unread input sends a RST, which can destroy responses the
+// client has not read yet; input left in the kernel by a pause goes first.
+void discardInput(HttpConn& c) {
+    char buf[16384];
+    if (c.readPaused)
+        while (recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+}
+
+void queueHead(HttpConn& c, const shared_ptr<const CachedResponse>& r, bool keepAlive) {
+    const string& head = keepAlive ? r->keepAliveHead : r->closeHead;
+    c.out.push_back({r, head.data(), head.size()});
+    c.pending += head.size();
+}
+
+// Queues bytes [off, off + len) of the body of `r`.
+void queueBody(HttpConn& c, const shared_ptr<const CachedResponse>& r, size_t off, size_t len) {
+    if (len == 0) return;
+    if (r->fd >= 0) {
+        // Hold the header back so it leaves in the same segment as the start
+        // of the file instead of as a tiny packet of its own.
+        if (!c.corked) {
+            int one = 1;
+            setsockopt(c.fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+            c.corked = true;
+        }
+        c.out.push_back({r, nullptr, len, off});
+    } else {
+        c.out.push_back({r, r->body.data() + off, len});
+    }
+    c.pending += len;
+}
+
+void queueResponse(HttpConn& c, const shared_ptr<const CachedResponse>& r, bool keepAlive, bool headOnly) {
+    queueHead(c, r, keepAlive);
+    if (!headOnly) queueBody(c, r, 0, r->length());
+}
+
+// If-None-Match wins over If-Modified-Since when both are present, and its
+// entity tags compare weakly, as RFC 9110 asks for conditional GETs.
+bool notModified(const HttpRequest& req, const CachedResponse& r) {
+    if (!req.ifNoneMatch.empty()) {
+        string_view list = req.ifNoneMatch;
+        if (trim(list) == "*") return true;
+        string_view ours = r.etag;
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            string_view tag = trim(list.substr(0, comma));
+            if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+            if (tag == ours) return true;
+            if (comma == string_view::npos) break;
+            list.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+    time_t since;
+    return !req.ifModifiedSince.empty() && parseHttpDate(trim(req.ifModifiedSince), since) && r.modified <= since;
+}
+
+// An If-Range that no longer matches turns the range request into a plain
+// GET of the new content. Entity tags compare strongly here.
+bool rangeApplies(const HttpRequest& req, const CachedResponse& r) {
+    string_view v = trim(req.ifRange);
+    if (v.empty()) return true;
+    if (v[0] == '"') return v == r.etag;
+    time_t date;
+    return parseHttpDate(v, date) && date == r.modified;
+}
+
+bool parseOffset(string_view s, size_t& v) {
+    if (s.empty()) return false;
+    auto [end, ec] = from_chars(s.data(), s.data() + s.size(), v);
+    return ec == errc() && end == s.data() + s.size();
+}
+
+enum class RangeStatus { None, Ok, Unsatisfiable };
+
+// Only a single "bytes=" range is served as 206. Multiple ranges, other units
+// and malformed values fall back to the full 200, which RFC 9110 allows.
+RangeStatus parseRange(string_view v, size_t length, size_t& first, size_t& last) {
+    v = trim(v);
+    if (v.size() < 6 || !equalsNoCase(v.substr(0, 6), "bytes=")) return RangeStatus::None;
+    v.remove_prefix(6);
+    size_t dash = v.find('-');
+    if (dash == string_view::npos || v.find(',') != string_view::npos) return RangeStatus::None;
+    string_view a = trim(v.substr(0, dash)), b = trim(v.substr(dash + 1));
+    if (a.empty()) {
+        size_t suffix;
+        if (!parseOffset(b, suffix)) return RangeStatus::None;
+        if (suffix == 0 || length == 0) return RangeStatus::Unsatisfiable;
+        first = length - min(suffix, length);
+        last = length - 1;
+        return RangeStatus::Ok;
+    }
+    if (!parseOffset(a, first)) return RangeStatus::None;
+    last = length - 1;
+    if (!b.empty()) {
+        size_t end;
+        if (!parseOffset(b, end) || end < first) return RangeStatus::None;
+        last = min(end, last);
+    }
+    return first < length ? RangeStatus::Ok : RangeStatus::Unsatisfiable;
+}
+
+// Built per request and never cached: Prometheus text by default, JSON
+// with ?format=json.
+void serveStats(HttpConn& c, string_view target, bool keepAlive, bool headOnly) {
+    bool json = target.find("format=json") != string_view::npos;
+    auto r = json ? makeResponse("", "200 OK", "application/json", g_metrics.json(), "Cache-Control: no-store\r\n")
+                  : makeResponse("", "200 OK", "text/plain; version=0.0.4", g_metrics.prometheus(),
+                                 "Cache-Control: no-store\r\n");
+    r->route = ROUTE_STATS;
+    queueResponse(c, r, keepAlive, headOnly);
+}
+
+void respond(HttpConn& c, const HttpRequest& req, bool keepAlive, string& scratch) {
+    bool head = req.method == "HEAD";
+    if (req.method != "GET" && !head) return queueResponse(c, g_methodNotAllowed, keepAlive, false);
+    if (req.target.substr(0, 7) == "/_stats" && (req.target.size() == 7 || req.target[7] == '?'))
+        return serveStats(c, req.target, keepAlive, head);
+    string_view key = req.target;
+    if (key == "/") {
+        key = "/index.html";
+    } else if (!isCanonical(key)) {
+        if (!resolveTarget(key, scratch)) return queueResponse(c, g_badRequest, keepAlive, false);
+        key = scratch;
+    }
+    shared_ptr<const CachedResponse> r = g_files.get(key);
+    if ((req.encodings & ACCEPT_BR) && r->br) r = r->br;
+    else if ((req.encodings & ACCEPT_GZIP) && r->gzip) r = r->gzip;
+    if (r->etag.empty()) return queueResponse(c, r, keepAlive, head);
+    if (notModified(req, *r)) return queueResponse(c, r->notModified, keepAlive, false);
+    size_t first, last;
+    RangeStatus range = req.range.empty() || !rangeApplies(req, *r) ? RangeStatus::None
+                                                                     : parseRange(req.range, r->length(), first, last);
+    if (range == RangeStatus::None) return queueResponse(c, r, keepAlive, head);
+    // Partial heads depend on the request, so they are built here and owned
+    // by the queued segment.
+    auto partial = make_shared<CachedResponse>();
+    partial->route = r->route;
+    partial->status = range == RangeStatus::Ok ? 206 : 416;
+    string total = to_string(r->length());
+    if (range == RangeStatus::Unsatisfiable) {
+        setHeads(*partial, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + total +
+                               "\r\nContent-Length: 0\r\n");
+        return queueHead(c, partial, keepAlive);
+    }
+    size_t len = last - first + 1;
+    setHeads(*partial, "HTTP/1.1 206 Partial Content\r\nContent-Type: " + string(r->type) +
+                           "\r\nContent-Length: " + to_string(len) + "\r\nContent-Range: bytes " +
+                           to_string(first) + "-" + to_string(last) + "/" + total + "\r\n" + r->meta);
+    queueHead(c, partial, keepAlive);
+    if (!head) queueBody(c, r, first, len);
+}
+
+// Queues a response for every complete request in the input buffer. Parsing
+// pauses while too much output is pending, so a client that pipelines
+// without reading cannot grow the queue without bound; returns true if it
+// paused for that reason.
+bool queueRequests(HttpConn& c, string& scratch) {
+    size_t used = 0;
+    bool paused = false;
+    steady_clock::time_point now{};
+    while (!c.closing) {
+        if (c.pending >= MAX_PENDING_OUT) {
+            paused = true;
+            break;
+        }
+        HttpRequest req;
+        size_t consumed = 0;
+        string_view data(c.in.data() + used, c.in.size() - used);
+        ParseStatus st = parseRequest(data, c.scanned, req, consumed);
+        if (st == ParseStatus::Incomplete) break;
+        // One clock read serves the whole batch of pipelined requests.
+        if (now == steady_clock::time_point{}) now = steady_clock::now();
+        size_t first = c.out.size();
+        if (st == ParseStatus::Bad) {
+            queueResponse(c, g_badRequest, false, false);
+            c.closing = true;
+        } else {
+            c.served++;
+            bool keepAlive = req.keepAlive && c.served < MAX_KEEPALIVE_REQUESTS;
+            respond(c, req, keepAlive, scratch);
+            if (!keepAlive) c.closing = true;
+        }
+        // The head segment's response names the status, even for a 206 whose
+        // body points into the full response.
+        const CachedResponse& r = *c.out[first].response;
+        c.out.back().metric = metricIndex(r.route, r.status);
+        c.out.back().parsed = now;
+        if (st == ParseStatus::Bad) break;
+        used += consumed;
+        c.scanned = 0;
+    }
+    if (used) c.in.erase(0, used);
+    return paused;
+}
+
+// Drops `n` written bytes from the front of the output queue.
+void consumeOutput(HttpConn& c, size_t n) {
+    c.pending -= n;
+    if (t_stats) bump(t_stats->bytesSent, n);
+    steady_clock::time_point now{};
+    while (n > 0) {
+        OutSegment& seg = c.out[c.outHead];
+        size_t rest = seg.len - c.outOff;
+        if (n < rest) {
+            c.outOff += n;
+            return;
+        }
+        n -= rest;
+        if (seg.metric >= 0 && t_stats) {
+            if (now == steady_clock::time_point{}) now = steady_clock::now();
+            t_stats->record(seg.metric, now - seg.parsed);
+        }
+        seg.response.reset();
+        c.outHead++;
+        c.outOff = 0;
+    }
+    if (c.outHead < c.out.size()) return;
+    c.out.clear();
+    c.outHead = 0;
+    c.outOff = 0;
+    if (c.corked) {
+        int zero = 0;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+        c.corked = false;
+    }
+}
+
+// One edge-triggered epoll loop per core. Every loop owns a SO_REUSEPORT
+// listener, so the kernel spreads accepts across loops and a connection never
+// leaves the thread that accepted it; no locks are needed on the hot path.
+// Connections are persistent: pipelined requests are answered in order, and
+// connections idle for longer than IDLE_TIMEOUT are closed by a sweep that
+// walks an activity-ordered list from its oldest end.
+class EventLoop {
+    using Conn = HttpConn;
+
+public:
+    bool open() {
+        m_listen = openListener(true);
+        if (m_listen < 0) return false;
+        fcntl(m_listen, F_SETFL, O_NONBLOCK);
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0) return false;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = m_listen;
+        return epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev) == 0;
+    }
+
+    void run() {
+        t_stats = &g_metrics.addWorker();
+        epoll_event events[256];
+        while (true) {
+            int n = epoll_wait(m_epoll, events, 256, 1000);
+            if (n < 0 && errno != EINTR) {
+                perror("epoll_wait");
+                return;
+            }
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == m_listen) {
+                    acceptAll();
+                    continue;
+                }
+                auto it = m_conns.find(fd);
+                if (it == m_conns.end()) continue;
+                Conn& c = *it->second;
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    closeConn(fd);
+                    continue;
+                }
+                touch(c);
+                bool keep = true;
+                if (events[i].events & EPOLLIN) keep = onReadable(c);
+                if (keep && (events[i].events & EPOLLOUT)) keep = flush(c) && process(c);
+                // Edge-triggered: input left in the kernel raises no new event.
+                if (keep && c.readPaused && !inputStalled(c)) keep = onReadable(c);
+                if (!keep) closeConn(fd);
+            }
+            sweepIdle();
+        }
+    }
+
+private:
+    void acceptAll() {
+        while (true) {
+            int c = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (c < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    bump(t_stats->acceptErrors);
+                    perror("accept");
+                }
+                return;
+            }
+            int one = 1;
+            setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = c;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, c, &ev) < 0) {
+                close(c);
+                continue;
+            }
+            auto conn = make_unique<Conn>();
+            conn->fd = c;
+            conn->lastActive = steady_clock::now();
+            conn->idlePos = m_idle.insert(m_idle.end(), c);
+            m_conns[c] = move(conn);
+            bump(t_stats->accepted);
+        }
+    }
+
+    // Edge-triggered: drain the socket until EAGAIN, or until the input
+    // stalls behind unsent output. Returns false once the connection should
+    // be closed.
+    bool onReadable(Conn& c) {
+        char buf[16384];
+        c.readPaused = false;
+        while (!c.eof) {
+            if (c.in.size() >= MAX_BUFFERED_IN) {
+                if (!process(c)) return false;
+                if (inputStalled(c)) {
+                    c.readPaused = true;
+                    return true;
+                }
+            }
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                if (!c.closing) c.in.append(buf, n);
+                continue;
+            }
+            if (n == 0) c.eof = true;
+            else if (errno == EINTR) continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            else return false;
+        }
+        return process(c);
+    }
+
+    // Answers every complete request in the input buffer and sends the batch.
+    bool process(Conn& c) {
+        while (true) {
+            bool paused = queueRequests(c, m_scratch);
+            if (!flush(c)) return false;
+            if (!paused || !c.out.empty()) break;
+        }
+        // Nothing more can arrive after EOF; close once the queue is drained.
+        return !(c.eof && c.out.empty());
+    }
+
+    // Writes as much of the queue as the socket accepts: runs of in-memory
+    // segments with one writev, file bodies with sendfile. The rest goes out
+    // on the next EPOLLOUT, so a large download costs a connection no more
+    // memory than a small one. Returns false on error or once the final
+    // response is fully written.
+    bool flush(Conn& c) {
+        while (c.outHead < c.out.size()) {
+            OutSegment& first = c.out[c.outHead];
+            ssize_t n;
+            if (!first.data) {
+                off_t off = (off_t)(first.fileOff + c.outOff);
+                n = sendfile(c.fd, first.response->fd, &off, first.len - c.outOff);
+                // The file shrank under us; the promised length cannot be met.
+                if (n == 0) return false;
+            } else {
+                iovec iov[64];
+                int count = 0;
+                for (size_t i = c.outHead; i < c.out.size() && c.out[i].data && count < 64; i++, count++) {
+                    size_t skip = i == c.outHead ? c.outOff : 0;
+                    iov[count].iov_base = (void*)(c.out[i].data + skip);
+                    iov[count].iov_len = c.out[i].len - skip;
+                }
+                n = writev(c.fd, iov, count);
+            }
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            consumeOutput(c, n);
+        }
+        return !c.closing;
+    }
+
+    void touch(Conn& c) {
+        c.lastActive = steady_clock::now();
+        m_idle.splice(m_idle.end(), m_idle, c.idlePos);
+    }
+
+    void sweepIdle() {
+        auto deadline = steady_clock::now() - IDLE_TIMEOUT;
+        while (!m_idle.empty()) {
+            int fd = (int)m_idle.front();
+            if (m_conns[fd]->lastActive > deadline) break;
+            closeConn(fd);
+        }
+    }
+
+    void closeConn(int fd) {
+        auto it = m_conns.find(fd);
+        discardInput(*it->second);
+        m_idle.erase(it->second->idlePos);
+        m_conns.erase(it);
+        close(fd);
+        bump(t_stats->closed);
+    }
+
+    int m_listen = -1;
+    int m_epoll = -1;
+    unordered_map<int, unique_ptr<Conn>> m_conns;
+    list<uint64_t> m_idle;
+    string m_scratch;
+};
+
+bool runEpoll(int workers) {
+    vector<unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < workers; i++) {
+        loops.push_back(make_unique<EventLoop>());
+        if (!loops.back()->open()) return false;
+    }
+    vector<thread> threads;
+    for (auto& loop : loops)
+        threads.emplace_back(&EventLoop::run, loop.get());
+    for (auto& t : threads) t.join();
+    return true;
+}
+
+// io_uring engine: the same per-core listeners and HTTP handling as
+// EventLoop, but accept and recv are multishot requests, recv takes its
+// buffers from a provided-buffer ring, sockets sit in the registered file
+// table, and all new requests go to the kernel in the same io_uring_enter
+// that waits for the next completions. File bodies are sent in chunks as a
+// linked READ_FIXED -> WRITE_FIXED pair through a small pool of registered
+// buffers. A connection object lives until its last request completes, so
+// the kernel never touches memory that has been freed.
+class UringLoop {
+public:
+    ~UringLoop() {
+        if (m_listen >= 0) close(m_listen);
+    }
+
+    // Must run on the thread that later calls run().
+    bool open() {
+        if (!m_ring.init(RING_ENTRIES)) return false;
+        if (!m_ring.setupBufferRing(RECV_GROUP, RECV_BUFFERS, RECV_BUFFER_SIZE)) return false;
+        m_fixedFiles = m_ring.registerFiles(FIXED_FILES);
+        m_slotMem.assign(FILE_SLOTS * FILE_CHUNK, 0);
+        vector<iovec> iov(FILE_SLOTS);
+        for (unsigned i = 0; i < FILE_SLOTS; i++) {
+            iov[i] = {m_slotMem.data() + i * FILE_CHUNK, FILE_CHUNK};
+            m_freeSlots.push_back(i);
+        }
+        if (!m_ring.registerBuffers(iov.data(), FILE_SLOTS)) return false;
+        m_listen = openListener(true);
+        return m_listen >= 0;
+    }
+
+    void run() {
+        t_stats = &g_metrics.addWorker();
+        armAccept();
+        armTick();
+        while (true) {
+            int r = m_ring.submitAndWait(1);
+            if (r < 0 && r != -EINTR && r != -EBUSY) {
+                errno = -r;
+                perror("io_uring_enter");
+                return;
+            }
+            m_ring.drain([this](const io_uring_cqe& cqe) { onCompletion(cqe); });
+        }
+    }
+
+    // Probes the running kernel with a throwaway ring.
+    static bool supported() {
+        Ring ring;
+        return ring.init(8) && ring.setupBufferRing(0, 8, 64);
+    }
+
+private:
+    static constexpr unsigned RING_ENTRIES = 4096;
+    static constexpr uint16_t RECV_GROUP = 0;
+    static constexpr unsigned RECV_BUFFERS = 512;
+    static constexpr size_t RECV_BUFFER_SIZE = 4096;
+    static constexpr unsigned FIXED_FILES = 16384;
+    static constexpr unsigned FILE_SLOTS = 32;
+    static constexpr size_t FILE_CHUNK = 64 * 1024;
+
+    enum Op : uint8_t { OP_ACCEPT, OP_TICK, OP_RECV, OP_SEND, OP_READ, OP_WRITE, OP_CANCEL };
+
+    struct Conn : HttpConn {
+        uint64_t id = 0;
+        bool fixed = false;
+        bool closed = false;
+        bool recvArmed = false;
+        bool sending = false;
+        bool waitingSlot = false;
+        int inflight = 0;
+        int slot = -1;
+        size_t chunkLen = 0;
+        size_t chunkSent = 0;
+        iovec iov[64];
+        msghdr msg{};
+    };
+
+    static uint64_t tag(uint64_t id, Op op) { return id << 8 | op; }
+
+    void setSocket(io_uring_sqe* s, const Conn& c) {
+        s->fd = c.fd;
+        if (c.fixed) s->flags |= IOSQE_FIXED_FILE;
+    }
+
+    void armAccept() {
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_ACCEPT;
+        s->fd = m_listen;
+        s->ioprio = IORING_ACCEPT_MULTISHOT;
+        s->accept_flags = SOCK_CLOEXEC;
+        s->user_data = tag(0, OP_ACCEPT);
+    }
+
+    void armTick() {
+        m_tick = {1, 0};
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_TIMEOUT;
+        s->fd = -1;
+        s->addr = (uint64_t)(uintptr_t)&m_tick;
+        s->len = 1;
+        s->user_data = tag(0, OP_TICK);
+    }
+
+    void armRecv(Conn& c) {
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_RECV;
+        setSocket(s, c);
+        s->ioprio = IORING_RECV_MULTISHOT;
+        s->flags |= IOSQE_BUFFER_SELECT;
+        s->buf_group = RECV_GROUP;
+        s->user_data = tag(c.id, OP_RECV);
+        c.recvArmed = true;
+        c.inflight++;
+    }
+
+    // A multishot recv would keep filling `in`; it is cancelled while the
+    // input is stalled and re-armed by process() once the output drains.
+    void pauseRecv(Conn& c) {
+        c.readPaused = true;
+        if (!c.recvArmed) return;
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_ASYNC_CANCEL;
+        s->fd = -1;
+        s->addr = tag(c.id, OP_RECV);
+        s->user_data = tag(c.id, OP_CANCEL);
+        c.inflight++;
+    }
+
+    void onCompletion(const io_uring_cqe& cqe) {
+        Op op = (Op)(cqe.user_data & 0xff);
+        uint64_t id = cqe.user_data >> 8;
+        if (op == OP_ACCEPT) {
+            if (!(cqe.flags & IORING_CQE_F_MORE)) armAccept();
+            if (cqe.res >= 0) addConn(cqe.res);
+            else bump(t_stats->acceptErrors);
+            return;
+        }
+        if (op == OP_TICK) {
+            sweepIdle();
+            armTick();
+            return;
+        }
+        auto it = m_conns.find(id);
+        if (it == m_conns.end()) {
+            // A straggler for a connection already gone (a cancelled or
+            // linked op completing late); only a picked buffer needs handing back.
+            if (cqe.flags & IORING_CQE_F_BUFFER) m_ring.recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            return;
+        }
+        Conn& c = *it->second;
+        // A multishot recv stays in flight until a completion without F_MORE.
+        if (op != OP_RECV || !(cqe.flags & IORING_CQE_F_MORE)) c.inflight--;
+        switch (op) {
+        case OP_RECV: onRecv(c, cqe); break;
+        case OP_SEND: onSent(c, cqe.res); break;
+        case OP_READ: break;  // a short read fails the link; OP_WRITE reports it
+        case OP_WRITE: onWritten(c, cqe.res); break;
+        default: break;
+        }
+        if (c.closed && c.inflight == 0) m_conns.erase(it);
+    }
+
+    void addConn(int fd) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto conn = make_unique<Conn>();
+        Conn& c = *conn;
+        c.fd = fd;
+        c.id = m_nextId++;
+        c.fixed = m_fixedFiles && (unsigned)fd < FIXED_FILES && m_ring.updateFile(fd, fd);
+        c.lastActive = steady_clock::now();
+        c.idlePos = m_idle.insert(m_idle.end(), c.id);
+        m_conns[c.id] = move(conn);
+        bump(t_stats->accepted);
+        armRecv(c);
+    }
+
+    void onRecv(Conn& c, const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) c.recvArmed = false;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (cqe.res > 0 && !c.closed && !c.closing) c.in.append(m_ring.buffer(bid), cqe.res);
+            m_ring.recycleBuffer(bid);
+        }
+        if (c.closed) return;
+        if (cqe.res == 0) c.eof = true;
+        else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) return closeConn(c);
+        touch(c);
+        process(c);
+        // Out of buffers or a one-shot completion: ask for more data.
+        if (!c.closed && !c.recvArmed && !c.eof && !c.readPaused) armRecv(c);
+    }
+
+    void process(Conn& c) {
+        queueRequests(c, m_scratch);
+        sendNext(c);
+        // Nothing more can arrive after EOF; close once the queue is drained.
+        if (c.eof && c.out.empty() && !c.sending) return closeConn(c);
+        if (c.closed) return;
+        if (!c.readPaused && inputStalled(c)) {
+            pauseRecv(c);
+        } else if (c.readPaused && !inputStalled(c)) {
+            c.readPaused = false;
+            if (!c.recvArmed && !c.eof) armRecv(c);
+        }
+    }
+
+    void sendNext(Conn& c) {
+        if (c.sending || c.outHead == c.out.size()) return;
+        if (!c.out[c.outHead].data) return sendFileChunk(c);
+        int count = 0;
+        for (size_t i = c.outHead; i < c.out.size() && c.out[i].data && count < 64; i++, count++) {
+            size_t skip = i == c.outHead ? c.outOff : 0;
+            c.iov[count].iov_base = (void*)(c.out[i].data + skip);
+            c.iov[count].iov_len = c.out[i].len - skip;
+        }
+        c.msg = {};
+        c.msg.msg_iov = c.iov;
+        c.msg.msg_iovlen = count;
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_SENDMSG;
+        setSocket(s, c);
+        s->addr = (uint64_t)(uintptr_t)&c.msg;
+        s->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        s->user_data = tag(c.id, OP_SEND);
+        c.sending = true;
+        c.inflight++;
+    }
+
+    void onSent(Conn& c, int res) {
+        c.sending = false;
+        if (c.closed) return;
+        if (res < 0) return closeConn(c);
+        consumeOutput(c, res);
+        afterSend(c);
+    }
+
+    void afterSend(Conn& c) {
+        touch(c);
+        if (c.closing && c.out.empty()) return closeConn(c);
+        process(c);
+    }
+
+    void sendFileChunk(Conn& c) {
+        if (m_freeSlots.empty()) {
+            if (!c.waitingSlot) m_slotWaiters.push_back(c.id);
+            c.waitingSlot = true;
+            return;
+        }
+        c.waitingSlot = false;
+        c.slot = (int)m_freeSlots.back();
+        m_freeSlots.pop_back();
+        const OutSegment& seg = c.out[c.outHead];
+        c.chunkLen = min(FILE_CHUNK, seg.len - c.outOff);
+        c.chunkSent = 0;
+        char* buf = m_slotMem.data() + c.slot * FILE_CHUNK;
+
+        // The read and the write it feeds are one chain.
+        m_ring.reserve(2);
+        io_uring_sqe* rd = m_ring.sqe();
+        rd->opcode = IORING_OP_READ_FIXED;
+        rd->fd = seg.response->fd;
+        rd->addr = (uint64_t)(uintptr_t)buf;
+        rd->len = (uint32_t)c.chunkLen;
+        rd->off = seg.fileOff + c.outOff;
+        rd->buf_index = (uint16_t)c.slot;
+        rd->flags = IOSQE_IO_LINK;
+        rd->user_data = tag(c.id, OP_READ);
+        writeChunk(c);
+        c.sending = true;
+        c.inflight++;
+    }
+
+    void writeChunk(Conn& c) {
+        io_uring_sqe* wr = m_ring.sqe();
+        wr->opcode = IORING_OP_WRITE_FIXED;
+        setSocket(wr, c);
+        wr->addr = (uint64_t)(uintptr_t)(m_slotMem.data() + c.slot * FILE_CHUNK + c.chunkSent);
+        wr->len = (uint32_t)(c.chunkLen - c.chunkSent);
+        wr->buf_index = (uint16_t)c.slot;
+        wr->user_data = tag(c.id, OP_WRITE);
+        c.inflight++;
+    }
+
+    void onWritten(Conn& c, int res) {
+        if (res > 0 && !c.closed) {
+            c.chunkSent += res;
+            if (c.chunkSent < c.chunkLen) return writeChunk(c);
+        }
+        // The chunk is done, failed, or was cancelled by a short file read.
+        releaseSlot(c);
+        c.sending = false;
+        if (c.closed) return;
+        if (res <= 0) return closeConn(c);
+        consumeOutput(c, c.chunkLen);
+        afterSend(c);
+    }
+
+    void releaseSlot(Conn& c) {
+        m_freeSlots.push_back((unsigned)c.slot);
+        c.slot = -1;
+        while (!m_slotWaiters.empty()) {
+            auto it = m_conns.find(m_slotWaiters.front());
+            m_slotWaiters.pop_front();
+            if (it != m_conns.end() && !it->second->closed) {
+                sendNext(*it->second);
+                break;
+            }
+        }
+    }
+
+    void touch(Conn& c) {
+        c.lastActive = steady_clock::now();
+        m_idle.splice(m_idle.end(), m_idle, c.idlePos);
+    }
+
+    void sweepIdle() {
+        auto deadline = steady_clock::now() - IDLE_TIMEOUT;
+        while (!m_idle.empty()) {
+            auto it = m_conns.find(m_idle.front());
+            if (it->second->lastActive > deadline) break;
+            closeConn(*it->second);
+            if (it->second->inflight == 0) m_conns.erase(it);
+        }
+    }
+
+    // shutdown() makes every request still in flight on the socket complete;
+    // the object itself goes once the last of them has been reaped.
+    void closeConn(Conn& c) {
+        if (c.closed) return;
+        c.closed = true;
+        m_idle.erase(c.idlePos);
+        discardInput(c);
+        shutdown(c.fd, SHUT_RDWR);
+        if (c.fixed) m_ring.updateFile(c.fd, -1);
+        close(c.fd);
+        bump(t_stats->closed);
+    }
+
+    Ring m_ring;
+    int m_listen = -1;
+    bool m_fixedFiles = false;
+    __kernel_timespec m_tick{};
+    vector<char> m_slotMem;
+    vector<unsigned> m_freeSlots;
+    deque<uint64_t> m_slotWaiters;
+    unordered_map<uint64_t, unique_ptr<Conn>> m_conns;
+    uint64_t m_nextId = 1;
+    list<uint64_t> m_idle;
+    string m_scratch;
+};
+
+bool runUring(int workers) {
+    if (!UringLoop::supported()) {
+        cerr << "io_uring unavailable, falling back to epoll" << endl;
+        return runEpoll(workers);
+    }
+    vector<unique_ptr<UringLoop>> loops;
+    vector<thread> threads;
+    for (int i = 0; i < workers; i++) {
+        loops.push_back(make_unique<UringLoop>());
+        threads.emplace_back([loop = loops.back().get()] {
+            if (loop->open()) loop->run();
+            else perror("io_uring");
+        });
+    }
+    for (auto& t : threads) t.join();
+    return true;
+}
+#endif
+
+// Every connection costs a descriptor, so lift the soft limit to the hard one.
+void raiseFdLimit() {
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int main(int argc, char** argv){
+#ifdef __linux__
+    string engine = "epoll";
+#else
+    string engine = "threads";
+#endif
+    int workers = max(1u, thread::hardware_concurrency());
+    size_t cacheMb = 64;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--engine") engine = argv[i + 1];
+        else if (arg == "--workers") workers = max(1, atoi(argv[i + 1]));
+        else if (arg == "--cache-mb") cacheMb = (size_t)max(0, atoi(argv[i + 1]));
+    }
+    signal(SIGPIPE, SIG_IGN);
+    raiseFdLimit();
+
+    cout<<"RUN http://localhost:"<<PORT<<" ("<<engine<<")"<<endl;
+
+#ifdef __linux__
+    if (engine == "epoll" || engine == "uring") {
+        g_files.configure(cacheMb << 20);
+        // Without change notifications cached files could go stale forever.
+        if (!g_files.watch()) {
+            perror("inotify");
+            g_files.configure(0);
+        }
+        return (engine == "uring" ? runUring(workers) : runEpoll(workers)) ? 0 : 1;
     }
+#endif
+    int s=openListener(false);
+    if(s<0)return 1;
+    runThreaded(s);
 }
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Thin io_uring wrapper on the raw syscalls, so the server needs no liburing:
+// ring setup and mapping, SQE allocation, batched submit-and-wait, CQE
+// draining, the registered file and buffer tables, and a provided-buffer ring
+// that multishot recv picks its buffers from. Every ring belongs to a single
+// thread, which must be the one that calls init().
+class Ring {
+public:
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    ~Ring() {
+        if (m_bufRing) munmap(m_bufRing, m_bufRingBytes);
+        if (m_sqes) munmap(m_sqes, m_sqeBytes);
+        if (m_cqMap && m_cqMap != m_sqMap) munmap(m_cqMap, m_cqBytes);
+        if (m_sqMap) munmap(m_sqMap, m_sqBytes);
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    // IORING_SETUP_SINGLE_ISSUER and multishot recv both arrived in Linux
+    // 6.0, so a kernel that accepts the flag has everything the server uses.
+    bool init(unsigned entries) {
+        io_uring_params p{};
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        p.cq_entries = entries * 4;
+        m_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (m_fd < 0) return false;
+
+        m_sqBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cqBytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) m_sqBytes = m_cqBytes = std::max(m_sqBytes, m_cqBytes);
+        m_sqMap = map(m_sqBytes, IORING_OFF_SQ_RING);
+        m_cqMap = single ? m_sqMap : map(m_cqBytes, IORING_OFF_CQ_RING);
+        m_sqeBytes = p.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)map(m_sqeBytes, IORING_OFF_SQES);
+        if (!m_sqMap || !m_cqMap || !m_sqes) return false;
+
+        char* sq = (char*)m_sqMap;
+        m_sqHead = (unsigned*)(sq + p.sq_off.head);
+        m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+        m_sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        m_sqEntries = p.sq_entries;
+        unsigned* array = (unsigned*)(sq + p.sq_off.array);
+        for (unsigned i = 0; i < m_sqEntries; i++) array[i] = i;
+        m_sqLocalTail = *m_sqTail;
+
+        char* cq = (char*)m_cqMap;
+        m_cqHead = (unsigned*)(cq + p.cq_off.head);
+        m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+        m_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // Never returns null: a full submission queue is flushed to the kernel.
+    io_uring_sqe* sqe() {
+        if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) submitAndWait(0);
+        io_uring_sqe* s = &m_sqes[m_sqLocalTail & m_sqMask];
+        m_sqLocalTail++;
+        memset(s, 0, sizeof(*s));
+        return s;
+    }
+
+    // Makes room for `count` SQEs that must reach the kernel together: a
+    // linked chain whose head sqe() flushed on its own would lose its link.
+    void reserve(unsigned count) {
+        if (m_sqEntries - (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) < count) submitAndWait(0);
+    }
+
+    // Submits everything queued since the last call and, in the same
+    // syscall, waits for at least `waitNr` completions.
+    int submitAndWait(unsigned waitNr) {
+        unsigned toSubmit = m_sqLocalTail - *m_sqTail;
+        __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+        unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+        int r = (int)syscall(__NR_io_uring_enter, m_fd, toSubmit, waitNr, flags, nullptr, 0);
+        return r < 0 ? -errno : r;
+    }
+
+    // Hands every available completion to `f` and then releases them.
+    template <class F>
+    void drain(F&& f) {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            io_uring_cqe cqe = m_cqes[head & m_cqMask];
+            f(cqe);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Sparse fixed-file table; slots are filled later with updateFile().
+    bool registerFiles(unsigned count) {
+        std::vector<int> fds(count, -1);
+        return reg(IORING_REGISTER_FILES, fds.data(), count) == 0;
+    }
+
+    bool updateFile(unsigned index, int fd) {
+        io_uring_files_update up{};
+        up.offset = index;
+        up.fds = (uint64_t)(uintptr_t)&fd;
+        return reg(IORING_REGISTER_FILES_UPDATE, &up, 1) == 1;
+    }
+
+    bool registerBuffers(const iovec* iov, unsigned count) {
+        return reg(IORING_REGISTER_BUFFERS, iov, count) == 0;
+    }
+
+    // Registers `entries` (a power of two) buffers of `size` bytes as buffer
+    // group `group` and hands them all to the kernel.
+    bool setupBufferRing(uint16_t group, unsigned entries, size_t size) {
+        m_bufRingBytes = entries * sizeof(io_uring_buf);
+        void* mem = mmap(nullptr, m_bufRingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return false;
+        m_bufRing = (io_uring_buf_ring*)mem;
+        io_uring_buf_reg r{};
+        r.ring_addr = (uint64_t)(uintptr_t)m_bufRing;
+        r.ring_entries = entries;
+        r.bgid = group;
+        if (reg(IORING_REGISTER_PBUF_RING, &r, 1) != 0) return false;
+        m_bufMem.assign(entries * size, 0);
+        m_bufSize = size;
+        m_bufMask = entries - 1;
+        for (unsigned bid = 0; bid < entries; bid++) recycleBuffer((uint16_t)bid);
+        return true;
+    }
+
+    const char* buffer(uint16_t bid) const { return m_bufMem.data() + bid * m_bufSize; }
+
+    void recycleBuffer(uint16_t bid) {
+        // Not m_bufRing->bufs: in C++ the empty struct inside the kernel's
+        // flex-array macro has size 1 and shifts that member by 8 bytes.
+        io_uring_buf& b = ((io_uring_buf*)m_bufRing)[m_bufTail & m_bufMask];
+        b.addr = (uint64_t)(uintptr_t)(m_bufMem.data() + bid * m_bufSize);
+        b.len = (uint32_t)m_bufSize;
+        b.bid = bid;
+        m_bufTail++;
+        __atomic_store_n(&m_bufRing->tail, m_bufTail, __ATOMIC_RELEASE);
+    }
+
+private:
+    void* map(size_t bytes, off_t offset) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int reg(unsigned op, const void* arg, unsigned count) {
+        int r = (int)syscall(__NR_io_uring_register, m_fd, op, arg, count);
+        return r < 0 ? -errno : r;
+    }
+
+    int m_fd = -1;
+    void* m_sqMap = nullptr;
+    void* m_cqMap = nullptr;
+    size_t m_sqBytes = 0;
+    size_t m_cqBytes = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqeBytes = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned m_sqLocalTail = 0;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    io_uring_buf_ring* m_bufRing = nullptr;
+    size_t m_bufRingBytes = 0;
+    std::vector<char> m_bufMem;
+    size_t m_bufSize = 0;
+    unsigned m_bufMask = 0;
+    uint16_t m_bufTail = 0;
+};